@@ -43,9 +43,9 @@ namespace MyApp
     int my_image_width = 0;
     int my_image_height = 0;
 
-    bool loadXMLFlag = false;
-    int loadRenderFlag = 0;
-    bool imageReady = false;
+    RenderCommandQueue commandQueue;
+    std::atomic<int> loadRenderFlag{0};
+    std::atomic<bool> imageReady{false};
 
     void LoadImage(LPDIRECT3DDEVICE9 device)
     {
@@ -97,10 +97,18 @@ namespace MyApp
         ImGui::SetCursorPosX((windowWidth - buttonWidth) * 0.5f); // Center the button
  
 
-        if (ImGui::Button("Render", ImVec2(buttonWidth, buttonHeight)))
+        if (ImGui::Button("Render", ImVec2(buttonWidth, buttonHeight)) && loadRenderFlag != 1)
         {   
             loadRenderFlag = 1;
             renderPressed = true;
+            commandQueue.push({RenderCommandType::Render, current_item});
+        }
+
+        if (loadRenderFlag == 1)
+        {
+            ImGui::SetCursorPosX((windowWidth - buttonWidth) * 0.5f);
+            if (ImGui::Button("Cancel", ImVec2(buttonWidth, buttonHeight)))
+                commandQueue.push({RenderCommandType::Cancel});
         }
 
         
@@ -117,7 +125,7 @@ namespace MyApp
 
         if (ImGui::Button("Load XML", ImVec2(buttonWidth, buttonHeight)))
         {
-            loadXMLFlag = true;
+            commandQueue.push({RenderCommandType::LoadScene, 0, "C:\\Users\\natyo\\OneDrive - Universidad EIA\\Escritorio\\POOH\\output.xml"});
             std::cout << "Loaded XML" << std::endl;
         }
 
@@ -5,14 +5,16 @@
 
 #include <windows.h>
 #include <d3d9.h>
+#include <atomic>
+#include "render_commands.h"
 
 
 namespace MyApp
 {
         //void LoadImage();
-        extern bool loadXMLFlag;
-        extern int loadRenderFlag;
-        extern bool imageReady;
+        extern RenderCommandQueue commandQueue;   // Commands for the render backend (main thread)
+        extern std::atomic<int> loadRenderFlag;   // 0 idle, 1 rendering, 2 image written
+        extern std::atomic<bool> imageReady;      // The backend wrote a new image
         extern int current_item;
         void InitTexture(const char* imagePath);
         void RenderUI();
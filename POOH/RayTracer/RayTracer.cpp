@@ -7,86 +7,1276 @@
 #include "material.hpp"
 #include "sphere.hpp"
 #include "bvh.hpp"
+#include "flat_bvh.hpp"
+#include "wide_bvh.hpp"
+#include "scene_geometry.hpp"
 #include "texture.hpp"
 #include "quad.hpp"
+#include "hash.hpp"
+#include "scene_description.hpp"
+#include "scene_file.hpp"
+#include "bvh_cache.hpp"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <exception>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
 
 
 // #include "stb_image_write.h"
 
 namespace RayTracing {
-    // Función que realiza el trazado de rayos
-    void traceRays(const std::vector<std::string>& shapeTypes,
+    struct PreparedScene {
+        shared_ptr<scene_geometry> geometry;
+        // Primitives, materials and lights of the scene
+        shared_ptr<hittable> world;
+        // What the rays are traced against: the geometry itself or a BVH over it
+        uint64_t hash = 0;
+        // FNV-1a hash of the scene description
+        double sceneSeconds = 0;
+        double bvhSeconds = 0;
+        // Time spent building the primitive tables and the BVH
+        int bvhRefits = 0;
+        int bvhRebuilds = 0;
+        // Whole-BVH refits and full rebuilds made by the commits of a SceneGraph
+    };
+
+    // Añade un material al hash, campo por campo (los structs tienen relleno entre campos)
+    static void hashMaterial(fnv1a& hash, const material_description& m) {
+        hash.add(m.kind);
+        hash.add(m.albedo);
+        hash.add(m.albedo2);
+        hash.add(m.parameter);
+    }
+
+    // Añade una primitiva al hash, campo por campo
+    static void hashPrimitive(fnv1a& hash, const primitive_description& p) {
+        hash.add(p.kind);
+        hash.add(p.material);
+        hash.add(p.p);
+        hash.add(p.u);
+        hash.add(p.v);
+        hash.add(p.radius);
+    }
+
+    // Hash FNV-1a de la escena
+    static uint64_t hashScene(const scene_description& scene) {
+        fnv1a hash;
+        hash.add(scene.materials.size());
+        for (const material_description& m : scene.materials)
+            hashMaterial(hash, m);
+        hash.add(scene.primitives.size());
+        for (const primitive_description& p : scene.primitives)
+            hashPrimitive(hash, p);
+        return hash.value;
+    }
+
+    // Material de una entrada de la tabla de materiales
+    static shared_ptr<material> makeMaterial(const material_description& m) {
+        if (m.kind == material_kind::lambertian)
+            return make_shared<lambertian>(make_shared<checker_texture>(2.0, m.albedo, m.albedo2));
+        if (m.kind == material_kind::metal)
+            return make_shared<metal>(m.albedo, m.parameter);
+        if (m.kind == material_kind::dielectric)
+            return make_shared<dielectric>(m.parameter);
+        if (m.kind == material_kind::diffuse_light)
+            return make_shared<diffuse_light>(m.albedo);
+        return nullptr;
+    }
+
+    // Añade las primitivas de un objeto: una esfera o un quad, o los seis quads de una caja
+    static void addPrimitive(scene_geometry& geometry, const primitive_description& p) {
+        if (p.kind == shape_kind::sphere) {
+            if ((p.u - p.p).length_squared() > 0)
+                geometry.add_moving_sphere(p.p, p.u, p.radius, p.material);
+            else
+                geometry.add_sphere(p.p, p.radius, p.material);
+        } else if (p.kind == shape_kind::quad) {
+            geometry.add_quad(p.p, p.u, p.v, p.material);
+        } else if (p.kind == shape_kind::box) {
+            geometry.add_box(p.p, p.u, p.material);
+            // The six sides go in the quad table so the BVH sees each of them
+        }
+    }
+
+    // Tablas de primitivas y materiales de una escena tipada
+    static shared_ptr<scene_geometry> buildGeometry(const scene_description& scene) {
+        auto geometry = make_shared<scene_geometry>();
+        // Every primitive of the scene in typed tables, boxes are split into their six quads
+
+        for (const material_description& m : scene.materials)
+            geometry->add_material(makeMaterial(m));
+
+        for (const primitive_description& p : scene.primitives)
+            addPrimitive(*geometry, p);
+        return geometry;
+    }
+
+    // BVH binario de la geometría: el de la caché si ya se construyó antes, si no se construye y se guarda
+    static shared_ptr<flat_bvh> cachedBvh(const shared_ptr<scene_geometry>& geometry, const RenderOptions& options) {
+        if (options.bvhCacheDir.empty())
+            return make_shared<flat_bvh>(geometry);
+        bvh_cache cache(options.bvhCacheDir);
+        uint64_t key = bvh_cache::key(*geometry);
+        shared_ptr<flat_bvh> binary = cache.load(geometry, key);
+        if (binary)
+            return binary;
+        binary = make_shared<flat_bvh>(geometry);
+        if (!cache.store(*binary, key))
+            std::cerr << "Could not write the BVH cache in " << options.bvhCacheDir << std::endl;
+        return binary;
+    }
+
+    // Lo que recorren los rayos: la geometría sola o un BVH sobre ella (el binario dado, si lo hay)
+    static shared_ptr<hittable> buildWorld(const shared_ptr<scene_geometry>& geometry, const RenderOptions& options,
+                                           shared_ptr<flat_bvh> binary) {
+        // Tiny scenes are cheaper to test linearly, everything else goes through a BVH
+        if (static_cast<int>(geometry->primitive_count()) < options.bvhThreshold)
+            return geometry;
+        if (!binary)
+            binary = cachedBvh(geometry, options);
+        if (options.bvhWidth == 4)
+            return make_shared<wide_bvh>(*binary);
+        return binary;
+    }
+
+    // Construye la geometría y el BVH de la escena
+    std::shared_ptr<const PreparedScene> prepareScene(const scene_description& scene, const RenderOptions& options) {
+        auto sceneStart = std::chrono::steady_clock::now();
+        auto geometry = buildGeometry(scene);
+
+        auto bvhStart = std::chrono::steady_clock::now();
+        shared_ptr<hittable> world = buildWorld(geometry, options, nullptr);
+        auto bvhEnd = std::chrono::steady_clock::now();
+
+        auto prepared = std::make_shared<PreparedScene>();
+        prepared->geometry = geometry;
+        prepared->world = world;
+        prepared->hash = hashScene(scene);
+        prepared->sceneSeconds = std::chrono::duration<double>(bvhStart - sceneStart).count();
+        prepared->bvhSeconds = std::chrono::duration<double>(bvhEnd - bvhStart).count();
+        return prepared;
+    }
+
+    // Misma escena con los materiales repetidos fundidos en uno
+    static scene_description shareMaterials(const scene_description& scene) {
+        scene_description shared;
+        shared.cameras = scene.cameras;
+        shared.primitives = scene.primitives;
+        std::map<std::array<double, 8>, uint32_t> known;
+        std::vector<uint32_t> remap(scene.materials.size());
+        for (size_t i = 0; i < scene.materials.size(); i++) {
+            const material_description& m = scene.materials[i];
+            std::array<double, 8> key = {static_cast<double>(m.kind), m.albedo.x(), m.albedo.y(), m.albedo.z(),
+                                         m.albedo2.x(), m.albedo2.y(), m.albedo2.z(), m.parameter};
+            auto found = known.emplace(key, static_cast<uint32_t>(shared.materials.size()));
+            if (found.second)
+                shared.materials.push_back(m);
+            remap[i] = found.first->second;
+        }
+        for (primitive_description& p : shared.primitives)
+            p.material = remap[p.material];
+        return shared;
+    }
+
+    bool writeSceneFile(const scene_description& scene, const std::string& path) {
+        scene_description shared = shareMaterials(scene);
+        auto geometry = buildGeometry(shared);
+        shared_ptr<flat_bvh> bvh;
+        if (geometry->primitive_count() > 0)
+            bvh = make_shared<flat_bvh>(geometry);
+        return scene_file::write(path, shared.cameras, shared.materials, *geometry, bvh.get(), hashScene(shared));
+    }
+
+    bool isSceneFile(const std::string& path) {
+        return scene_file::is_scene_file(path);
+    }
+
+    std::shared_ptr<const PreparedScene> openSceneFile(const std::string& path, std::vector<camera_description>& cameras,
+                                                       const RenderOptions& options) {
+        auto sceneStart = std::chrono::steady_clock::now();
+        scene_file file;
+        if (!file.open(path))
+            return nullptr;
+
+        // Solo los materiales se construyen, las tablas de primitivas se usan desde el archivo
+        auto geometry = make_shared<scene_geometry>();
+        for (size_t i = 0; i < file.material_count(); i++)
+            geometry->add_material(makeMaterial(file.material(i)));
+        if (!file.attach(*geometry))
+            return nullptr;
+
+        cameras.clear();
+        for (size_t i = 0; i < file.camera_count(); i++)
+            cameras.push_back(file.camera(i));
+
+        auto bvhStart = std::chrono::steady_clock::now();
+        shared_ptr<flat_bvh> stored = file.has_bvh() ? file.bvh(geometry) : nullptr;
+        if (file.has_bvh() && !stored)
+            return nullptr;
+        shared_ptr<hittable> world = buildWorld(geometry, options, stored);
+        auto bvhEnd = std::chrono::steady_clock::now();
+
+        auto prepared = std::make_shared<PreparedScene>();
+        prepared->geometry = geometry;
+        prepared->world = world;
+        prepared->hash = file.hash();
+        prepared->sceneSeconds = std::chrono::duration<double>(bvhStart - sceneStart).count();
+        prepared->bvhSeconds = std::chrono::duration<double>(bvhEnd - bvhStart).count();
+        return prepared;
+    }
+
+    // Pasa las tablas de vectores de traceRays a una escena tipada
+    static scene_description describeScene(const std::vector<std::string>& shapeTypes,
            const std::vector<std::vector<double>>& Colors,
            const std::vector<std::vector<double>>& Colors2,
            const std::vector<std::string>& Materials,
-           const std::vector<double>& Radio, 
+           const std::vector<double>& Radio,
            const std::vector<std::vector<double>>& Position,
            const std::vector<std::vector<double>>& Position2,
-           int vfov,
-           const std::vector<double>& lookfrom,
-           const std::vector<double>& lookat,
-           const std::vector<double>& vup,
-           int RenderType,
-           const std::vector<double>& backGrounColor,
            const std::vector<std::vector<double>>& Origen,
            const std::vector<std::vector<double>>& Vect_1,
            const std::vector<std::vector<double>>& Vect_2,
            const std::vector<std::vector<double>>& Point_1,
            const std::vector<std::vector<double>>& Point_2) {
+        auto vec = [](const std::vector<double>& v) { return vec3(v[0], v[1], v[2]); };
 
-
-        hittable_list world;  
-                 
-
-
-        for (int i = 0; i < Materials.size(); i++) {
-            shared_ptr<material> material;
-
-            std::string materialType = Materials[i];
+        scene_description scene;
+        for (size_t i = 0; i < Materials.size(); i++) {
+            material_description m;
             if (Materials[i] == "lambertian") {
-                auto checker = make_shared<checker_texture>(2.0, color(Colors[i][0], Colors[i][1], Colors[i][2]), color(Colors2[i][0], Colors2[i][1], Colors2[i][2]));
-                material = make_shared<lambertian>(checker);           
+                m.kind = material_kind::lambertian;
+                m.albedo = vec(Colors[i]);
+                m.albedo2 = vec(Colors2[i]);
             } else if (Materials[i] == "metal") {
-                material = make_shared<metal>(color(Colors[i][0], Colors[i][1], Colors[i][2]), Colors[i][3]);
+                m.kind = material_kind::metal;
+                m.albedo = vec(Colors[i]);
+                m.parameter = Colors[i][3];
             } else if (Materials[i] == "dielectric") {
-                material = make_shared<dielectric>(Colors[i][0]);
+                m.kind = material_kind::dielectric;
+                m.parameter = Colors[i][0];
             } else if (Materials[i] == "difflight") {
-                material = make_shared<diffuse_light>(color(Colors[i][0], Colors[i][1], Colors[i][2]));
+                m.kind = material_kind::diffuse_light;
+                m.albedo = vec(Colors[i]);
             }
+            scene.materials.push_back(m);
+            // One material per object, also for shapes that are not known
+
+            primitive_description p;
+            p.material = static_cast<uint32_t>(i);
+            if (shapeTypes[i] == "sphere") {
+                p.kind = shape_kind::sphere;
+                p.p = vec(Position[i]);
+                p.u = vec(Position2[i]);
+                p.radius = Radio[i];
+            } else if (shapeTypes[i] == "quad") {
+                p.kind = shape_kind::quad;
+                p.p = vec(Origen[i]);
+                p.u = vec(Vect_1[i]);
+                p.v = vec(Vect_2[i]);
+            } else if (shapeTypes[i] == "box") {
+                p.kind = shape_kind::box;
+                p.p = vec(Point_1[i]);
+                p.u = vec(Point_2[i]);
+            } else {
+                continue;
+            }
+            scene.primitives.push_back(p);
+        }
+        return scene;
+    }
+
+    std::shared_ptr<const PreparedScene> prepareScene(const std::vector<std::string>& shapeTypes,
+           const std::vector<std::vector<double>>& Colors,
+           const std::vector<std::vector<double>>& Colors2,
+           const std::vector<std::string>& Materials,
+           const std::vector<double>& Radio,
+           const std::vector<std::vector<double>>& Position,
+           const std::vector<std::vector<double>>& Position2,
+           const std::vector<std::vector<double>>& Origen,
+           const std::vector<std::vector<double>>& Vect_1,
+           const std::vector<std::vector<double>>& Vect_2,
+           const std::vector<std::vector<double>>& Point_1,
+           const std::vector<std::vector<double>>& Point_2,
+           const RenderOptions& options) {
+        return prepareScene(describeScene(shapeTypes, Colors, Colors2, Materials, Radio, Position, Position2,
+                                          Origen, Vect_1, Vect_2, Point_1, Point_2), options);
+    }
+
+    // Cámara a partir de los vectores de traceRays
+    static camera_description describeCamera(int vfov,
+           const std::vector<double>& lookfrom,
+           const std::vector<double>& lookat,
+           const std::vector<double>& vup,
+           const std::vector<double>& backGrounColor) {
+        camera_description camera;
+        camera.vfov = vfov;
+        camera.lookfrom = point3(lookfrom[0], lookfrom[1], lookfrom[2]);
+        camera.lookat = point3(lookat[0], lookat[1], lookat[2]);
+        camera.vup = vec3(vup[0], vup[1], vup[2]);
+        camera.background = color(backGrounColor[0], backGrounColor[1], backGrounColor[2]);
+        return camera;
+    }
+
+    size_t primitiveCount(const PreparedScene& scene) {
+        return scene.geometry->primitive_count();
+    }
+
+    struct SceneGraph::State {
+        RenderOptions options;
+        std::shared_ptr<PreparedScene> prepared;
+        // Scene handed to the renders, its geometry and BVH are the ones below
+        shared_ptr<scene_geometry> geometry;
+        shared_ptr<flat_bvh> bvh;
+        camera_description view;
+
+        std::vector<material_description> materials;
+        std::vector<uint32_t> materialUsers;
+        // Objects using each material
+        std::vector<bool> materialLive;
+        std::vector<uint32_t> freeMaterials;
+        // Ids of removed materials, reused first
+
+        struct Object {
+            primitive_description description;
+            uint32_t primitives[6];
+            // Indices of its primitives in the geometry (they change when another one is removed)
+            uint32_t count = 0;
+            bool live = false;
+            bool moved = false;
+            // Changed in place since the last commit
+        };
+        std::vector<Object> objects;
+        std::vector<uint32_t> freeObjects;
+        std::vector<uint32_t> primitiveObject;
+        // Object id of every primitive of the geometry
+        std::vector<uint32_t> moved;
+        // Objects changed in place since the last commit, the commit refits their BVH leaves
+
+        bool edited = false;
+    };
+
+    // Compara dos vectores componente a componente
+    static bool sameVec(const vec3& a, const vec3& b) {
+        return a.x() == b.x() && a.y() == b.y() && a.z() == b.z();
+    }
+
+    static bool sameMaterial(const material_description& a, const material_description& b) {
+        return a.kind == b.kind && sameVec(a.albedo, b.albedo) && sameVec(a.albedo2, b.albedo2) && a.parameter == b.parameter;
+    }
+
+    static bool sameObject(const primitive_description& a, const primitive_description& b) {
+        return a.kind == b.kind && a.material == b.material && sameVec(a.p, b.p) && sameVec(a.u, b.u) &&
+               sameVec(a.v, b.v) && a.radius == b.radius;
+    }
+
+    // Esfera quieta, esfera en movimiento o cualquier otra forma (el tipo de primitiva que le toca)
+    static int primitiveShape(const primitive_description& p) {
+        if (p.kind == shape_kind::sphere)
+            return (p.u - p.p).length_squared() > 0 ? 1 : 0;
+        return 2 + static_cast<int>(p.kind);
+    }
+
+    // Hash de lo que la escena contiene ahora, sea cual sea el orden de las ediciones que la dejaron así:
+    // los materiales y los objetos vivos por id, no las tablas, donde una edición puede mover primitivas
+    static uint64_t hashGraph(const SceneGraph::State& s) {
+        fnv1a hash;
+        for (uint32_t i = 0; i < s.materials.size(); i++)
+            if (s.materialLive[i]) {
+                hash.add(i);
+                hashMaterial(hash, s.materials[i]);
+            }
+        for (uint32_t i = 0; i < s.objects.size(); i++)
+            if (s.objects[i].live) {
+                hash.add(i);
+                hashPrimitive(hash, s.objects[i].description);
+            }
+        return hash.value;
+    }
+
+    // Antes de una edición: si alguien (un render en curso) aún tiene la escena entregada por el
+    // último commit, la geometría y el BVH se copian y las ediciones van a la copia
+    static void detach(SceneGraph::State& s) {
+        if (s.prepared.use_count() == 1)
+            return;
+        auto prepared = std::make_shared<PreparedScene>(*s.prepared);
+        s.geometry = s.geometry->copy();
+        s.bvh = s.bvh->copy(s.geometry);
+        prepared->geometry = s.geometry;
+        prepared->world = s.bvh;
+        s.prepared = prepared;
+    }
+
+    // Añade a la geometría y al BVH las primitivas de un objeto
+    static void insertPrimitives(SceneGraph::State& s, uint32_t id) {
+        SceneGraph::State::Object& object = s.objects[id];
+        uint32_t first = static_cast<uint32_t>(s.geometry->primitive_count());
+        addPrimitive(*s.geometry, object.description);
+        object.count = static_cast<uint32_t>(s.geometry->primitive_count()) - first;
+        for (uint32_t k = 0; k < object.count; k++) {
+            object.primitives[k] = first + k;
+            s.primitiveObject.push_back(id);
+            s.bvh->insert_primitive(first + k);
+        }
+    }
+
+    // Quita las primitivas de un objeto; la última primitiva de la geometría ocupa el índice de cada una
+    static void erasePrimitives(SceneGraph::State& s, uint32_t id) {
+        SceneGraph::State::Object& object = s.objects[id];
+        while (object.count > 0) {
+            uint32_t prim = object.primitives[--object.count];
+            s.bvh->remove_primitive(prim);
+            uint32_t moved = s.geometry->remove_primitive(prim);
+            s.bvh->rename_primitive(moved, prim);
+            if (moved != prim) {
+                SceneGraph::State::Object& owner = s.objects[s.primitiveObject[moved]];
+                for (uint32_t k = 0; k < owner.count; k++)
+                    if (owner.primitives[k] == moved)
+                        owner.primitives[k] = prim;
+                s.primitiveObject[prim] = s.primitiveObject[moved];
+            }
+            s.primitiveObject.pop_back();
+        }
+    }
+
+    // Cambia un objeto vivo: en su sitio si sigue siendo la misma forma, si no sus primitivas se quitan y se añaden de nuevo
+    static void changeObject(SceneGraph::State& s, uint32_t id, const primitive_description& p) {
+        SceneGraph::State::Object& object = s.objects[id];
+        const primitive_description old = object.description;
+        s.materialUsers[old.material]--;
+        s.materialUsers[p.material]++;
+        object.description = p;
+
+        int shape = primitiveShape(p);
+        if (shape != primitiveShape(old) || p.kind == shape_kind::box) {
+            erasePrimitives(s, id);
+            insertPrimitives(s, id);
+            return;
+        }
+        uint32_t prim = object.primitives[0];
+        if (shape == 0)
+            s.geometry->set_sphere(prim, p.p, p.radius, p.material);
+        else if (shape == 1)
+            s.geometry->set_moving_sphere(prim, p.p, p.u, p.radius, p.material);
+        else
+            s.geometry->set_quad(prim, p.p, p.u, p.v, p.material);
+        if (!object.moved) {
+            object.moved = true;
+            s.moved.push_back(id);
+        }
+    }
+
+    // Ajusta el BVH a los objetos cambiados en su sitio: hoja por hoja si son pocos, si no todo
+    // el árbol de una vez, y lo reconstruye si el ajuste lo dejó demasiado caro
+    static void refitMoved(SceneGraph::State& s) {
+        std::vector<uint32_t> prims;
+        for (uint32_t id : s.moved) {
+            SceneGraph::State::Object& object = s.objects[id];
+            object.moved = false;
+            if (object.live)
+                prims.insert(prims.end(), object.primitives, object.primitives + object.count);
+        }
+        s.moved.clear();
+        if (prims.empty())
+            return;
+        if (prims.size() * 8 < s.geometry->primitive_count()) {
+            for (uint32_t prim : prims)
+                s.bvh->update_primitive(prim);
+            return;
+        }
+        // Each leaf update walks up to the root, a whole refit visits every node once
+        s.bvh->refit(s.options.numThreads);
+        s.prepared->bvhRefits++;
+        if (s.bvh->sah_cost() > (1 + s.options.refitCostLimit) * s.bvh->build_cost()) {
+            s.bvh->rebuild();
+            s.prepared->bvhRebuilds++;
+        }
+    }
+
+    // Pone un material en la posición id, creándola o reviviéndola si hace falta
+    static void putMaterial(SceneGraph::State& s, uint32_t id, const material_description& m) {
+        detach(s);
+        if (id == s.materials.size()) {
+            s.materials.push_back(m);
+            s.materialUsers.push_back(0);
+            s.materialLive.push_back(true);
+            s.geometry->add_material(makeMaterial(m));
+        } else {
+            if (!s.materialLive[id])
+                s.freeMaterials.erase(std::find(s.freeMaterials.begin(), s.freeMaterials.end(), id));
+            s.materials[id] = m;
+            s.materialLive[id] = true;
+            s.geometry->set_material(id, makeMaterial(m));
+        }
+        s.edited = true;
+    }
+
+    // Pone un objeto en la posición id, creándola o reviviéndola si hace falta
+    static bool putObject(SceneGraph::State& s, uint32_t id, const primitive_description& p) {
+        if (p.material >= s.materials.size() || !s.materialLive[p.material])
+            return false;
+        detach(s);
+        if (id < s.objects.size() && s.objects[id].live) {
+            changeObject(s, id, p);
+        } else {
+            if (id >= s.objects.size()) {
+                // Los ids que quedan entre medias quedan libres
+                for (uint32_t gap = static_cast<uint32_t>(s.objects.size()); gap < id; gap++)
+                    s.freeObjects.push_back(gap);
+                s.objects.resize(id + 1);
+            } else {
+                auto free = std::find(s.freeObjects.begin(), s.freeObjects.end(), id);
+                if (free != s.freeObjects.end())
+                    s.freeObjects.erase(free);
+            }
+            s.objects[id].description = p;
+            s.objects[id].live = true;
+            s.materialUsers[p.material]++;
+            insertPrimitives(s, id);
+        }
+        s.edited = true;
+        return true;
+    }
+
+    SceneGraph::SceneGraph(const RenderOptions& options) : state(std::make_shared<State>()) {
+        state->options = options;
+    }
+
+    void SceneGraph::load(const scene_description& scene) {
+        State& s = *state;
+        if (!scene.cameras.empty())
+            s.view = scene.cameras[0];
+        if (s.prepared) {
+            // Solo las diferencias con lo que ya hay
+            for (uint32_t i = 0; i < scene.materials.size(); i++)
+                if (i >= s.materials.size() || !s.materialLive[i] || !sameMaterial(s.materials[i], scene.materials[i]))
+                    putMaterial(s, i, scene.materials[i]);
+            for (uint32_t i = 0; i < scene.primitives.size(); i++) {
+                if (i < s.objects.size() && s.objects[i].live && sameObject(s.objects[i].description, scene.primitives[i]))
+                    continue;
+                if (putObject(s, i, scene.primitives[i]))
+                    continue;
+                // Sin un material que exista el objeto se deja fuera y su id queda libre, como en la primera carga
+                if (i < s.objects.size() && s.objects[i].live) {
+                    removeObject(i);
+                } else if (i >= s.objects.size()) {
+                    s.objects.resize(i + 1);
+                    s.objects[i].description = scene.primitives[i];
+                    s.freeObjects.push_back(i);
+                }
+            }
+            for (size_t i = scene.primitives.size(); i < s.objects.size(); i++)
+                if (s.objects[i].live)
+                    removeObject(static_cast<uint32_t>(i));
+            for (size_t i = scene.materials.size(); i < s.materials.size(); i++)
+                if (s.materialLive[i])
+                    removeMaterial(static_cast<uint32_t>(i));
+            return;
+        }
+
+        // Primera carga: todo se construye de una vez, como prepareScene
+        auto sceneStart = std::chrono::steady_clock::now();
+        s.geometry = make_shared<scene_geometry>();
+        s.materials = scene.materials;
+        s.materialUsers.assign(scene.materials.size(), 0);
+        s.materialLive.assign(scene.materials.size(), true);
+        for (const material_description& m : scene.materials)
+            s.geometry->add_material(makeMaterial(m));
+
+        s.objects.resize(scene.primitives.size());
+        for (uint32_t i = 0; i < scene.primitives.size(); i++) {
+            const primitive_description& p = scene.primitives[i];
+            State::Object& object = s.objects[i];
+            object.description = p;
+            if (p.material >= scene.materials.size()) {
+                s.freeObjects.push_back(i);
+                continue;
+                // An object with a material that does not exist is left out, its id stays free
+            }
+            object.live = true;
+            s.materialUsers[p.material]++;
+            uint32_t first = static_cast<uint32_t>(s.geometry->primitive_count());
+            addPrimitive(*s.geometry, p);
+            object.count = static_cast<uint32_t>(s.geometry->primitive_count()) - first;
+            for (uint32_t k = 0; k < object.count; k++) {
+                object.primitives[k] = first + k;
+                s.primitiveObject.push_back(i);
+            }
+        }
+
+        auto bvhStart = std::chrono::steady_clock::now();
+        s.bvh = cachedBvh(s.geometry, s.options);
+        auto bvhEnd = std::chrono::steady_clock::now();
+
+        s.prepared = std::make_shared<PreparedScene>();
+        s.prepared->geometry = s.geometry;
+        s.prepared->world = s.bvh;
+        // Always the BVH, even for tiny scenes: it is what the edits keep up to date
+        s.prepared->hash = hashGraph(s);
+        s.prepared->sceneSeconds = std::chrono::duration<double>(bvhStart - sceneStart).count();
+        s.prepared->bvhSeconds = std::chrono::duration<double>(bvhEnd - bvhStart).count();
+    }
+
+    uint32_t SceneGraph::addMaterial(const material_description& material) {
+        State& s = *state;
+        if (!s.prepared)
+            load(scene_description());
+        uint32_t id = s.freeMaterials.empty() ? static_cast<uint32_t>(s.materials.size()) : s.freeMaterials.back();
+        putMaterial(s, id, material);
+        return id;
+    }
+
+    bool SceneGraph::setMaterial(uint32_t id, const material_description& material) {
+        State& s = *state;
+        if (id >= s.materials.size() || !s.materialLive[id])
+            return false;
+        putMaterial(s, id, material);
+        return true;
+    }
+
+    bool SceneGraph::removeMaterial(uint32_t id) {
+        State& s = *state;
+        if (id >= s.materials.size() || !s.materialLive[id] || s.materialUsers[id] > 0)
+            return false;
+        detach(s);
+        s.geometry->set_material(id, nullptr);
+        s.materialLive[id] = false;
+        s.freeMaterials.push_back(id);
+        s.edited = true;
+        return true;
+    }
+
+    uint32_t SceneGraph::addObject(const primitive_description& object) {
+        State& s = *state;
+        if (!s.prepared)
+            load(scene_description());
+        uint32_t id = s.freeObjects.empty() ? static_cast<uint32_t>(s.objects.size()) : s.freeObjects.back();
+        return putObject(s, id, object) ? id : invalidId;
+    }
+
+    bool SceneGraph::setObject(uint32_t id, const primitive_description& object) {
+        State& s = *state;
+        if (id >= s.objects.size() || !s.objects[id].live)
+            return false;
+        return putObject(s, id, object);
+    }
+
+    bool SceneGraph::removeObject(uint32_t id) {
+        State& s = *state;
+        if (id >= s.objects.size() || !s.objects[id].live)
+            return false;
+        detach(s);
+        State::Object& object = s.objects[id];
+        erasePrimitives(s, id);
+        s.materialUsers[object.description.material]--;
+        object.live = false;
+        s.freeObjects.push_back(id);
+        s.edited = true;
+        return true;
+    }
+
+    void SceneGraph::setCamera(const camera_description& camera) {
+        state->view = camera;
+    }
+
+    camera_description SceneGraph::camera() const {
+        return state->view;
+    }
+
+    std::shared_ptr<const PreparedScene> SceneGraph::commit() {
+        State& s = *state;
+        if (!s.prepared)
+            load(scene_description());
+        if (!s.edited)
+            return s.prepared;
+
+        auto start = std::chrono::steady_clock::now();
+        s.geometry->update_lights();
+        s.geometry->update_bounds();
+        refitMoved(s);
+        if (s.bvh->worn_out()) {
+            s.bvh->rebuild();
+            s.prepared->bvhRebuilds++;
+        }
+        s.prepared->hash = hashGraph(s);
+        s.prepared->sceneSeconds = 0;
+        s.prepared->bvhSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        s.edited = false;
+        return s.prepared;
+    }
+
+    // Curva de tonos de las opciones
+    static tone_mapping toneMapping(const RenderOptions& options) {
+        tone_mapping tone;
+        if (options.tonemap == Tonemap::Reinhard)
+            tone.op = tone_operator::reinhard;
+        else if (options.tonemap == Tonemap::Aces)
+            tone.op = tone_operator::aces;
+        tone.exposure = options.exposure;
+        tone.gamma = options.gamma;
+        return tone;
+    }
+
+    // Copia la imagen lineal de la cámara para el llamador
+    static void copyFrame(const framebuffer& frame, HdrImage* image) {
+        if (!image)
+            return;
+        image->width = frame.width;
+        image->height = frame.height;
+        image->rgba = frame.rgba;
+    }
+
+    // Relación de aspecto de la imagen pedida (16:9 si no se da la altura)
+    static double aspectRatio(const RenderOptions& options) {
+        return (options.imageHeight > 0) ? static_cast<double>(options.imageWidth) / options.imageHeight : 16.0 / 9.0;
+    }
+
+    int imageHeight(const RenderOptions& options) {
+        int height = static_cast<int>(options.imageWidth / aspectRatio(options) + 1e-6);
+        return (height < 1) ? 1 : height;
+    }
+
+    int samplesPerPixel(int RenderType, const RenderOptions& options) {
+        if (options.samplesPerPixel > 0)
+            return options.samplesPerPixel;
+        if (RenderType == 1)
+            return 30;
+        if (RenderType == 2)
+            return 300;
+        if (RenderType == 3)
+            return 800;
+        return 10;
+    }
+
+    // Lanza el render de una cámara ya configurada: un trozo, una imagen fija o pasadas progresivas
+    static bool renderCamera(camera& cam, const PreparedScene& scene, const RenderOptions& options, int samplesPerPass) {
+        if (options.partial) {
+            PartialFrame& part = *options.partial;
+            part.width = options.imageWidth;
+            part.height = imageHeight(options);
+            if (part.rowEnd <= 0 || part.rowEnd > part.height)
+                part.rowEnd = part.height;
+            if (part.sampleEnd <= 0)
+                part.sampleEnd = cam.samples_per_pixel;
+            part.rowBegin = std::max(0, std::min(part.rowBegin, part.rowEnd));
+            part.sampleBegin = std::max(0, std::min(part.sampleBegin, part.sampleEnd));
+            return cam.render_partial(*scene.world, part.rowBegin, part.rowEnd, part.sampleBegin, part.sampleEnd, part.sum);
+        }
+
+        if (samplesPerPass <= 0) {
+            bool complete = cam.render(*scene.world);
+            if (complete)
+                copyFrame(cam.frame, options.hdrImage);
+            return complete;
+        }
+
+        frame_accumulator accumulator;
+        if (options.accumulation) {
+            accumulator.width = options.accumulation->width;
+            accumulator.height = options.accumulation->height;
+            accumulator.samples = options.accumulation->samplesPerPixel;
+            accumulator.sum.swap(options.accumulation->sum);
+        }
+
+        framebuffer passFrame;
+        std::vector<unsigned char> preview;
+        bool complete = cam.render_progressive(*scene.world, accumulator, samplesPerPass,
+            [&](const frame_accumulator& acc) {
+                if (!options.onPass)
+                    return;
+                acc.resolve(passFrame);
+                cam.tone.to_8bit(passFrame, preview);
+                options.onPass(preview, acc.width, acc.height, acc.samples);
+            });
+        copyFrame(cam.frame, options.hdrImage);
 
-            if (shapeTypes[i] == "sphere"){
-                world.add(make_shared<sphere>(point3(Position[i][0], Position[i][1], Position[i][2]), point3(Position2[i][0], Position2[i][1], Position2[i][2]), Radio[i], material));
-            } else if(shapeTypes[i] == "quad"){
-                world.add(make_shared<quad>(point3(Origen[i][0], Origen[i][1], Origen[i][2]), vec3(Vect_1[i][0], Vect_1[i][1], Vect_1[i][2]), vec3(Vect_2[i][0], Vect_2[i][1], Vect_2[i][2]), material));
-            } else if(shapeTypes[i] == "box"){
-                world.add(box(point3(Point_1[i][0], Point_1[i][1], Point_1[i][2]), point3(Point_2[i][0], Point_2[i][1], Point_2[i][2]), material));
-            }     
+        if (options.accumulation) {
+            options.accumulation->width = accumulator.width;
+            options.accumulation->height = accumulator.height;
+            options.accumulation->samplesPerPixel = accumulator.samples;
+            options.accumulation->sum.swap(accumulator.sum);
         }
-        
+        return complete;
+    }
+
+    // Renderiza una escena ya construida desde una cámara, devuelve false si se canceló
+    static bool renderWithProgress(const PreparedScene& scene,
+           const camera_description& view,
+           int RenderType,
+           const RenderOptions& options,
+           render_progress* progress) {
+
         camera cam;
 
-        cam.aspect_ratio = 16.0 / 9.0;
-        cam.image_width  = 300;
-        cam.background = color(backGrounColor[0], backGrounColor[1], backGrounColor[2]);
+        cam.image_width  = options.imageWidth;
+        cam.aspect_ratio = aspectRatio(options);
+        cam.background = view.background;
 
         if (RenderType == 1) {
             cam.max_depth  = 10;
-            cam.samples_per_pixel = 30; 
         } else if (RenderType == 2) {
             cam.max_depth  = 100;
-            cam.samples_per_pixel = 300;
         } else if (RenderType == 3) {
             cam.max_depth  = 200;
-            cam.samples_per_pixel = 800;
         }
 
-        cam.vfov = vfov;
-        cam.lookfrom = point3(lookfrom[0],lookfrom[1],lookfrom[2]);
-        cam.lookat = point3(lookat[0],lookat[1],lookat[2]);
-        cam.vup = vec3(vup[0],vup[1],vup[2]);
+        cam.samples_per_pixel = samplesPerPixel(RenderType, options);
+        if (options.maxDepth > 0)
+            cam.max_depth = options.maxDepth;
+        if (!options.outputPath.empty())
+            cam.output_path = options.outputPath;
+        cam.hdr_output_path = options.hdrOutputPath;
+        cam.tone = toneMapping(options);
+
+        cam.vfov = view.vfov;
+        cam.lookfrom = view.lookfrom;
+        cam.lookat = view.lookat;
+        cam.vup = view.vup;
+
+        cam.num_threads = options.numThreads;
+        cam.tile_size = options.tileSize;
+        cam.seed = options.seed;
+        cam.packet_size = options.packetSize;
+        cam.roulette_depth = options.rouletteDepth;
+        cam.adaptive_threshold = options.adaptiveThreshold;
+        cam.adaptive_min_samples = options.adaptiveMinSamples;
+        cam.adaptive_max_samples = options.adaptiveMaxSamples;
+        if (options.sampleLights) {
+            cam.integrator = integrator_mode::light_sampling;
+            cam.lights = &scene.geometry->lights();
+        }
+
+        cam.progress = progress;
+        cam.cancel = options.cancel;
+        cam.checkpoint_path = options.checkpointPath;
+        cam.checkpoint_interval = options.checkpointInterval;
+        cam.scene_key = scene.hash;
+
+        int samplesPerPass = options.samplesPerPass;
+        if (samplesPerPass <= 0 && !options.checkpointPath.empty())
+            samplesPerPass = 16;
+        // Los checkpoints se guardan entre pasadas, un render con checkpoint siempre es progresivo
 
-        cam.render(world);
+        render_stats stats;
+        if (!options.statsPath.empty())
+            cam.stats = &stats;
+
+        bool complete = renderCamera(cam, scene, options, samplesPerPass);
+
+        if (cam.stats) {
+            stats.scene_seconds = scene.sceneSeconds;
+            stats.bvh_seconds = scene.bvhSeconds;
+            stats.threads = (options.numThreads > 0) ? options.numThreads : omp_get_max_threads();
+            stats.width = options.imageWidth;
+            stats.height = imageHeight(options);
+            stats.samples_per_pixel = cam.samples_per_pixel;
+            stats.samples_taken = cam.samples_taken;
+            if (!stats.write_json(options.statsPath))
+                std::cerr << "Could not write " << options.statsPath << '\n';
+        }
+        return complete;
+    }
+
+    void renderPreparedScene(const PreparedScene& scene,
+           int vfov,
+           const std::vector<double>& lookfrom,
+           const std::vector<double>& lookat,
+           const std::vector<double>& vup,
+           int RenderType,
+           const std::vector<double>& backGrounColor,
+           const RenderOptions& options) {
+        renderWithProgress(scene, describeCamera(vfov, lookfrom, lookat, vup, backGrounColor), RenderType, options, nullptr);
+    }
+
+    void renderPreparedScene(const PreparedScene& scene,
+           const camera_description& camera,
+           int RenderType,
+           const RenderOptions& options) {
+        renderWithProgress(scene, camera, RenderType, options, nullptr);
+    }
+
+    struct RenderHandle::State {
+        render_progress progress;
+        // Counters updated by the render threads
+        std::chrono::steady_clock::time_point start;
+        std::mutex mutex;
+        std::condition_variable finishedSignal;
+        bool finished = false;
+        bool completed = false;
+        // The render ran to the end (it was not cancelled)
+        std::exception_ptr error;
+    };
+
+    RenderProgress RenderHandle::progress() const {
+        RenderProgress p;
+        if (!state)
+            return p;
+        p.tilesTotal = state->progress.tiles_total.load();
+        p.tilesDone = state->progress.tiles_done.load();
+        p.samplesDone = state->progress.samples_done.load();
+        p.raysTraced = state->progress.rays_traced.load();
+        p.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - state->start).count();
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            p.finished = state->finished;
+            p.cancelled = state->finished && !state->completed;
+        }
+        if (p.finished)
+            p.etaSeconds = 0;
+        else if (p.tilesDone > 0 && p.tilesTotal >= p.tilesDone)
+            p.etaSeconds = p.elapsedSeconds * static_cast<double>(p.tilesTotal - p.tilesDone) / p.tilesDone;
+        return p;
+    }
+
+    void RenderHandle::cancel() {
+        if (state)
+            state->progress.cancel = true;
+    }
+
+    bool RenderHandle::finished() const {
+        if (!state)
+            return true;
+        std::lock_guard<std::mutex> lock(state->mutex);
+        return state->finished;
+    }
+
+    bool RenderHandle::wait() const {
+        if (!state)
+            return false;
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->finishedSignal.wait(lock, [this] { return state->finished; });
+        if (state->error)
+            std::rethrow_exception(state->error);
+        return state->completed;
+    }
+
+    RenderHandle renderPreparedSceneAsync(std::shared_ptr<const PreparedScene> scene,
+           int vfov,
+           const std::vector<double>& lookfrom,
+           const std::vector<double>& lookat,
+           const std::vector<double>& vup,
+           int RenderType,
+           const std::vector<double>& backGrounColor,
+           const RenderOptions& options) {
+        RenderHandle handle;
+        auto state = std::make_shared<RenderHandle::State>();
+        state->start = std::chrono::steady_clock::now();
+        handle.state = state;
+
+        // The render thread owns copies of everything it reads, so the caller's vectors
+        // may go away as soon as this returns
+        camera_description view = describeCamera(vfov, lookfrom, lookat, vup, backGrounColor);
+        std::thread([state, scene, view, RenderType, options]() {
+            bool completed = false;
+            std::exception_ptr error;
+            try {
+                completed = renderWithProgress(*scene, view, RenderType, options, &state->progress);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished = true;
+                state->completed = completed;
+                state->error = error;
+            }
+            state->finishedSignal.notify_all();
+        }).detach();
+
+        return handle;
+    }
+
+    // Función que realiza el trazado de rayos
+    void traceRays(const std::vector<std::string>& shapeTypes,
+           const std::vector<std::vector<double>>& Colors,
+           const std::vector<std::vector<double>>& Colors2,
+           const std::vector<std::string>& Materials,
+           const std::vector<double>& Radio, 
+           const std::vector<std::vector<double>>& Position,
+           const std::vector<std::vector<double>>& Position2,
+           int vfov,
+           const std::vector<double>& lookfrom,
+           const std::vector<double>& lookat,
+           const std::vector<double>& vup,
+           int RenderType,
+           const std::vector<double>& backGrounColor,
+           const std::vector<std::vector<double>>& Origen,
+           const std::vector<std::vector<double>>& Vect_1,
+           const std::vector<std::vector<double>>& Vect_2,
+           const std::vector<std::vector<double>>& Point_1,
+           const std::vector<std::vector<double>>& Point_2,
+           const RenderOptions& options) {
+        auto scene = prepareScene(shapeTypes, Colors, Colors2, Materials, Radio, Position, Position2,
+                                  Origen, Vect_1, Vect_2, Point_1, Point_2, options);
+        renderPreparedScene(*scene, vfov, lookfrom, lookat, vup, RenderType, backGrounColor, options);
+    }
+
+    void traceRays(const scene_description& scene, int RenderType, const RenderOptions& options) {
+        camera_description view;
+        if (!scene.cameras.empty())
+            view = scene.cameras[0];
+        renderPreparedScene(*prepareScene(scene, options), view, RenderType, options);
+    }
+
+    // Gira un vector alrededor de un eje unitario (fórmula de Rodrigues)
+    static vec3 rotate(const vec3& v, const vec3& axis, double radians) {
+        double c = std::cos(radians), s = std::sin(radians);
+        return c * v + s * cross(axis, v) + (1 - c) * dot(axis, v) * axis;
+    }
+
+    // Misma escena con cada caja cambiada por sus seis lados: la primera cara ocupa el sitio de
+    // la caja y las otras cinco van al final
+    static scene_description splitBoxes(const scene_description& scene) {
+        scene_description split = scene;
+        for (size_t i = 0; i < scene.primitives.size(); i++) {
+            const primitive_description& box = scene.primitives[i];
+            if (box.kind != shape_kind::box)
+                continue;
+            point3 Q[6];
+            vec3 u[6], v[6];
+            scene_geometry::box_sides(box.p, box.u, Q, u, v);
+            for (int k = 0; k < 6; k++) {
+                primitive_description side = box;
+                side.kind = shape_kind::quad;
+                side.p = Q[k];
+                side.u = u[k];
+                side.v = v[k];
+                if (k == 0)
+                    split.primitives[i] = side;
+                else
+                    split.primitives.push_back(side);
+            }
+        }
+        return split;
+    }
+
+    // Un objeto de la animación durante el intervalo [t0, t1] de la secuencia
+    static primitive_description animateObject(const primitive_description& p, const Animation& animation,
+                                               const camera_description& view, double t0, double t1) {
+        vec3 axis = unit_vector(view.vup);
+        double radians = degrees_to_radians(animation.turntableDegrees);
+        auto place = [&](const point3& q, double t) { return view.lookat + rotate(q - view.lookat, axis, radians * t); };
+
+        primitive_description frame = p;
+        if (p.kind == shape_kind::sphere) {
+            // A sphere with a second position moves there over the whole sequence
+            frame.p = place(p.p + t0 * (p.u - p.p), t0);
+            frame.u = animation.motionBlur ? place(p.p + t1 * (p.u - p.p), t1) : frame.p;
+        } else {
+            frame.p = place(p.p, t0);
+            frame.u = rotate(p.u, axis, radians * t0);
+            frame.v = rotate(p.v, axis, radians * t0);
+        }
+        return frame;
+    }
+
+    // La cámara de la animación en el instante t
+    static camera_description animateCamera(const camera_description& view, const Animation& animation, double t) {
+        camera_description frame = view;
+        if (animation.flyTo.size() == 3) {
+            vec3 offset = t * (point3(animation.flyTo[0], animation.flyTo[1], animation.flyTo[2]) - view.lookfrom);
+            frame.lookfrom += offset;
+            frame.lookat += offset;
+        }
+        return frame;
+    }
+
+    // Nombre del archivo de un fotograma: "{frame}" se cambia por el número con cuatro cifras;
+    // si no está, el número va antes de la extensión
+    static std::string framePath(const std::string& pattern, int frame) {
+        if (pattern.empty())
+            return pattern;
+        char number[16];
+        std::snprintf(number, sizeof number, "%04d", frame);
+        size_t mark = pattern.find("{frame}");
+        if (mark != std::string::npos)
+            return pattern.substr(0, mark) + number + pattern.substr(mark + 7);
+        size_t dot = pattern.find_last_of('.');
+        size_t slash = pattern.find_last_of("/\\");
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            return pattern + "_" + number;
+        return pattern.substr(0, dot) + "_" + number + pattern.substr(dot);
+    }
+
+    AnimationReport renderAnimation(const scene_description& scene, const Animation& animation, int RenderType,
+                                    const RenderOptions& options) {
+        AnimationReport report;
+        scene_description base = splitBoxes(scene);
+        camera_description view;
+        if (!scene.cameras.empty())
+            view = scene.cameras[0];
+
+        SceneGraph graph(options);
+        int frames = std::max(animation.frames, 1);
+        for (int f = 0; f < frames; f++) {
+            if (options.cancel && options.cancel->load())
+                break;
+            double t0 = static_cast<double>(f) / frames;
+            double t1 = static_cast<double>(f + 1) / frames;
+
+            // El grafo compara el fotograma con el anterior y solo cambia los objetos que se movieron
+            auto updateStart = std::chrono::steady_clock::now();
+            scene_description frame;
+            frame.materials = base.materials;
+            frame.cameras.push_back(animateCamera(view, animation, t0));
+            frame.primitives.reserve(base.primitives.size());
+            for (const primitive_description& p : base.primitives)
+                frame.primitives.push_back(animateObject(p, animation, view, t0, t1));
+            graph.load(frame);
+            std::shared_ptr<const PreparedScene> prepared = graph.commit();
+            auto renderStart = std::chrono::steady_clock::now();
+
+            RenderOptions frameOptions = options;
+            frameOptions.outputPath = framePath(options.outputPath, f);
+            frameOptions.hdrOutputPath = framePath(options.hdrOutputPath, f);
+            frameOptions.statsPath = framePath(options.statsPath, f);
+            frameOptions.checkpointPath = framePath(options.checkpointPath, f);
+            frameOptions.partial = nullptr;
+            frameOptions.accumulation = nullptr;
+            bool complete = renderWithProgress(*prepared, graph.camera(), RenderType, frameOptions, nullptr);
+            auto renderEnd = std::chrono::steady_clock::now();
+
+            report.updateSeconds += std::chrono::duration<double>(renderStart - updateStart).count();
+            report.renderSeconds += std::chrono::duration<double>(renderEnd - renderStart).count();
+            report.bvhRefits = prepared->bvhRefits;
+            report.bvhRebuilds = prepared->bvhRebuilds;
+            if (!complete)
+                break;
+            report.frames++;
+        }
+        return report;
+    }
+
+    RenderHandle traceRaysAsync(const std::vector<std::string>& shapeTypes,
+           const std::vector<std::vector<double>>& Colors,
+           const std::vector<std::vector<double>>& Colors2,
+           const std::vector<std::string>& Materials,
+           const std::vector<double>& Radio, 
+           const std::vector<std::vector<double>>& Position,
+           const std::vector<std::vector<double>>& Position2,
+           int vfov,
+           const std::vector<double>& lookfrom,
+           const std::vector<double>& lookat,
+           const std::vector<double>& vup,
+           int RenderType,
+           const std::vector<double>& backGrounColor,
+           const std::vector<std::vector<double>>& Origen,
+           const std::vector<std::vector<double>>& Vect_1,
+           const std::vector<std::vector<double>>& Vect_2,
+           const std::vector<std::vector<double>>& Point_1,
+           const std::vector<std::vector<double>>& Point_2,
+           const RenderOptions& options) {
+        auto scene = prepareScene(shapeTypes, Colors, Colors2, Materials, Radio, Position, Position2,
+                                  Origen, Vect_1, Vect_2, Point_1, Point_2, options);
+        return renderPreparedSceneAsync(scene, vfov, lookfrom, lookat, vup, RenderType, backGrounColor, options);
+    }
+
+    bool writeImage(const HdrImage& image, const std::string& path, const RenderOptions& options) {
+        framebuffer frame;
+        frame.width = image.width;
+        frame.height = image.height;
+        frame.rgba = image.rgba;
+        return image_io::write_image(path, frame, toneMapping(options));
+    }
+
+    bool readPfm(const std::string& path, HdrImage& image) {
+        framebuffer frame;
+        if (!image_io::read_pfm(path, frame))
+            return false;
+        copyFrame(frame, &image);
+        return true;
+    }
+
+    // Cabecera de un trozo de imagen: "RTPART1\0" y seis enteros de 32 bits
+    static const char partialMagic[8] = {'R', 'T', 'P', 'A', 'R', 'T', '1', '\0'};
+
+    bool writePartialFrame(std::ostream& out, const PartialFrame& part) {
+        std::vector<unsigned char> bytes(partialMagic, partialMagic + 8);
+        for (int value : {part.width, part.height, part.rowBegin, part.rowEnd, part.sampleBegin, part.sampleEnd})
+            image_io::put_u32(bytes, static_cast<uint32_t>(value));
+        for (float value : part.sum)
+            image_io::put_float(bytes, value);
+        out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        out.flush();
+        return static_cast<bool>(out);
+    }
+
+    bool readPartialFrame(std::istream& in, PartialFrame& part) {
+        unsigned char header[8 + 6 * 4];
+        if (!in.read(reinterpret_cast<char*>(header), sizeof header) || std::memcmp(header, partialMagic, 8) != 0)
+            return false;
+        int32_t fields[6];
+        for (int k = 0; k < 6; ++k) {
+            uint32_t bits = 0;
+            for (int b = 0; b < 4; ++b)
+                bits |= static_cast<uint32_t>(header[8 + 4 * k + b]) << (8 * b);
+            fields[k] = static_cast<int32_t>(bits);
+        }
+        part.width = fields[0];
+        part.height = fields[1];
+        part.rowBegin = fields[2];
+        part.rowEnd = fields[3];
+        part.sampleBegin = fields[4];
+        part.sampleEnd = fields[5];
+        if (part.width <= 0 || part.height <= 0 || part.rowBegin < 0 || part.rowEnd > part.height ||
+            part.rowBegin > part.rowEnd || part.sampleBegin > part.sampleEnd)
+            return false;
+
+        std::vector<unsigned char> bytes(static_cast<size_t>(part.rowEnd - part.rowBegin) * part.width * 12);
+        if (!in.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size())))
+            return false;
+        part.sum.resize(bytes.size() / 4);
+        for (size_t k = 0; k < part.sum.size(); ++k) {
+            uint32_t bits = 0;
+            for (int b = 0; b < 4; ++b)
+                bits |= static_cast<uint32_t>(bytes[4 * k + b]) << (8 * b);
+            std::memcpy(&part.sum[k], &bits, sizeof bits);
+        }
+        return true;
+    }
+
+    bool mergePartialFrames(const std::vector<PartialFrame>& parts, HdrImage& image) {
+        if (parts.empty())
+            return false;
+        int width = parts[0].width;
+        int height = parts[0].height;
+
+        // Suma de las muestras y número de muestras de cada fila (todas las muestras de un
+        // trozo cubren sus filas por igual)
+        std::vector<double> sum(static_cast<size_t>(width) * height * 3, 0.0);
+        std::vector<long long> rowSamples(height, 0);
+        for (const PartialFrame& part : parts) {
+            if (part.width != width || part.height != height ||
+                part.sum.size() != static_cast<size_t>(part.rowEnd - part.rowBegin) * width * 3)
+                return false;
+            size_t offset = static_cast<size_t>(part.rowBegin) * width * 3;
+            for (size_t k = 0; k < part.sum.size(); ++k)
+                sum[offset + k] += part.sum[k];
+            for (int j = part.rowBegin; j < part.rowEnd; ++j)
+                rowSamples[j] += part.sampleEnd - part.sampleBegin;
+        }
+
+        image.width = width;
+        image.height = height;
+        image.rgba.assign(static_cast<size_t>(width) * height * 4, 1.0f);
+        for (int j = 0; j < height; ++j) {
+            if (rowSamples[j] <= 0)
+                return false;
+            // Una fila sin muestras: faltan trozos
+            double scale = 1.0 / rowSamples[j];
+            for (int i = 0; i < width; ++i) {
+                size_t p = static_cast<size_t>(j) * width + i;
+                for (int c = 0; c < 3; ++c)
+                    image.rgba[p * 4 + c] = static_cast<float>(sum[p * 3 + c] * scale);
+            }
+        }
+        return true;
     }
-}
\ No newline at end of file
+}
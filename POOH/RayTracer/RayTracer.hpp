@@ -5,8 +5,324 @@
 
 #include <vector>
 #include <string>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <iosfwd>
+#include <cstdint>
+
+struct scene_description;
+struct camera_description;
+struct material_description;
+struct primitive_description;
+// Typed scene read from a scene file (see scene_description.hpp and loadScene)
 
 namespace RayTracing {
+    struct Accumulation {
+        // Samples accumulated by a progressive render, kept by the caller to resume it
+        int width = 0;
+        int height = 0;
+        int samplesPerPixel = 0;
+        // Samples per pixel accumulated so far
+        std::vector<float> sum;
+        // Sum of the samples, RGB floats per pixel, rows from top to bottom
+    };
+
+    enum class Tonemap {
+        Clamp,     // Values above 1 are cut off
+        Reinhard,  // x / (1 + x), keeps detail in the highlights
+        Aces       // Filmic curve, more contrast than Reinhard
+    };
+
+    struct HdrImage {
+        // Linear radiance of a render, kept to tonemap it again without rendering
+        int width = 0;
+        int height = 0;
+        std::vector<float> rgba;
+        // Four floats per pixel (alpha is 1), rows from top to bottom
+    };
+
+    struct PartialFrame {
+        // Piece of a frame rendered by one process of a distributed render. Set the ranges
+        // before the render; it fills in the rest.
+        int width = 0;
+        int height = 0;
+        // Size of the whole frame
+        int rowBegin = 0;
+        int rowEnd = 0;
+        // Rows rowBegin .. rowEnd - 1 (rowEnd 0 goes to the last row)
+        int sampleBegin = 0;
+        int sampleEnd = 0;
+        // Sample indices traced for every pixel of those rows (sampleEnd 0 goes to the
+        // samples per pixel of the render)
+        std::vector<float> sum;
+        // Sum of the samples, RGB floats per pixel of the rows
+    };
+
+    struct RenderOptions {
+        int imageWidth = 300;
+        // Width of the image in pixels
+        int imageHeight = 0;
+        // Height of the image in pixels (0 keeps the 16:9 aspect ratio)
+        int samplesPerPixel = 0;
+        // Samples per pixel (0 takes the ones of the RenderType)
+        int maxDepth = 0;
+        // Maximum number of bounces of a path (0 takes the one of the RenderType)
+        std::string outputPath;
+        // Image written by the render (empty keeps the default location): .exr and .pfm keep
+        // the linear float radiance, any other name is written as a tonemapped PNG
+        std::string hdrOutputPath;
+        // Optional second file, e.g. an .exr next to the PNG of outputPath
+        Tonemap tonemap = Tonemap::Clamp;
+        double exposure = 0;
+        // Exposure compensation in stops applied before the tonemapping curve
+        double gamma = 2.0;
+        // Display gamma of the 8 bit output (1 writes linear values)
+        HdrImage* hdrImage = nullptr;
+        // Receives the linear frame whenever the render writes its image
+        int numThreads = 0;
+        // Number of render threads (0 uses every hardware thread)
+        int tileSize = 16;
+        // Side length in pixels of the tiles shared out between the threads
+        unsigned long long seed = 0;
+        // Seed of the sample generators, a given seed always renders the same image
+        int bvhThreshold = 8;
+        // Scenes with fewer primitives than this are tested linearly instead of through a BVH
+        int bvhWidth = 2;
+        // Branching factor of the BVH: 2 (binary) or 4 (wide, better for diffuse bounces)
+        std::string bvhCacheDir;
+        // Directory of prebuilt BVHs (empty disables the cache): a scene whose primitives hash
+        // to a BVH saved there by an earlier run maps that BVH instead of building it, and a
+        // BVH that had to be built is saved for the next run. Camera and material changes
+        // keep the hash.
+        double refitCostLimit = 0.3;
+        // When a SceneGraph commit moved many primitives in place it refits the whole BVH
+        // instead of building it; once the SAH cost of the refitted BVH has grown past
+        // (1 + this) times the cost it had when built, the BVH is built again
+        int packetSize = 0;
+        // Trace primary rays in SIMD packets of 4 or 8 rays (0 traces them one by one)
+        int rouletteDepth = 3;
+        // Bounces before Russian roulette may end a path (negative only stops at the depth limit)
+        bool sampleLights = false;
+        // Aim shadow rays at the emissive spheres and quads (next event estimation with
+        // multiple importance sampling), converges with far fewer samples on small lights
+        double adaptiveThreshold = 0;
+        // Adaptive sampling: a pixel stops once the standard error of its mean luminance falls
+        // below this fraction of the mean, e.g. 0.02 (0 keeps the fixed samples per pixel)
+        int adaptiveMinSamples = 0;
+        // Samples every pixel takes before its noise is checked (0 means a quarter of the samples of the RenderType)
+        int adaptiveMaxSamples = 0;
+        // Samples a noisy pixel may take (0 means four times the samples of the RenderType)
+
+        int samplesPerPass = 0;
+        // Progressive mode when > 0: samples are accumulated pass after pass (a first
+        // one-sample pass, then this many per pass) and onPass shows each intermediate image
+        std::function<void(const std::vector<unsigned char>& rgb, int width, int height, int samplesPerPixel)> onPass;
+        // Called on the rendering thread after every pass with the 8 bit RGB image so far
+        const std::atomic<bool>* cancel = nullptr;
+        // When set to true, the render threads stop after their current tile (a progressive
+        // render keeps the passes it finished)
+        Accumulation* accumulation = nullptr;
+        // Progressive renders continue from and update this accumulation (resume after a cancel)
+        std::string checkpointPath;
+        // Binary checkpoint file: the render saves its samples there as it goes and, when run
+        // again with the same scene, camera, seed and samplesPerPass, resumes where the last
+        // run stopped, giving the image an uninterrupted render would have. The file is
+        // deleted once the render completes. Setting it makes the render progressive (16
+        // samples per pass unless samplesPerPass says otherwise, adaptive sampling is not used).
+        double checkpointInterval = 60;
+        // Seconds between two checkpoints (one is also saved when the render is cancelled)
+        std::string statsPath;
+        // JSON file written at the end of the render with the time of each phase and, in
+        // builds with RT_ENABLE_STATS, ray, BVH node, primitive test and path counts
+        PartialFrame* partial = nullptr;
+        // When set, only the rows and samples it asks for are traced into its sum and no
+        // image is written (see mergePartialFrames)
+    };
+
+    struct PreparedScene;
+    // Geometry and BVH of a scene, ready to be rendered from any camera. Rendering only reads
+    // it, so one prepared scene can be cached and used by several renders at once.
+
+    struct RenderProgress {
+        unsigned long long tilesDone = 0;
+        unsigned long long tilesTotal = 0;
+        // Tiles finished and tiles to render (over every pass of a progressive render)
+        unsigned long long samplesDone = 0;
+        // Camera samples traced so far
+        unsigned long long raysTraced = 0;
+        // Rays traced so far (camera rays, bounces and shadow rays)
+        double elapsedSeconds = 0;
+        double etaSeconds = -1;
+        // Estimated time left, from the tiles done so far (-1 until the first tile is done)
+        bool finished = false;
+        bool cancelled = false;
+    };
+
+    class RenderHandle {
+        // Render running in the background, returned by the *Async functions. Copies of a
+        // handle refer to the same render.
+    public:
+        RenderProgress progress() const;
+        // Progress so far, can be called from any thread at any time
+        void cancel();
+        // Ask the render to stop: the render threads drop out after their current tile
+        bool finished() const;
+        // True once the render thread is done (finished or cancelled)
+        bool wait() const;
+        // Block until the render thread is done, returns false if it was cancelled
+
+        struct State;
+    private:
+        std::shared_ptr<State> state;
+
+        friend RenderHandle renderPreparedSceneAsync(std::shared_ptr<const PreparedScene> scene, int vfov,
+                                                     const std::vector<double>& lookfrom, const std::vector<double>& lookat,
+                                                     const std::vector<double>& vup, int RenderType,
+                                                     const std::vector<double>& backGrounColor, const RenderOptions& options);
+    };
+
+    std::shared_ptr<const PreparedScene> prepareScene(const std::vector<std::string>& shapeTypes,
+                   const std::vector<std::vector<double>>& Colors,
+                   const std::vector<std::vector<double>>& Colors2,
+                   const std::vector<std::string>& Materials,
+                   const std::vector<double>& Radio,
+                   const std::vector<std::vector<double>>& Position,
+                   const std::vector<std::vector<double>>& Position2,
+                   const std::vector<std::vector<double>>& Origen,
+                   const std::vector<std::vector<double>>& Vect_1,
+                   const std::vector<std::vector<double>>& Vect_2,
+                   const std::vector<std::vector<double>>& Point_1,
+                   const std::vector<std::vector<double>>& Point_2,
+                   const RenderOptions& options = RenderOptions());
+    // Builds the scene (only bvhThreshold and bvhWidth of the options are used)
+
+    std::shared_ptr<const PreparedScene> prepareScene(const scene_description& scene,
+                   const RenderOptions& options = RenderOptions());
+    // Same, straight from the typed scene of a scene file
+
+    bool writeSceneFile(const scene_description& scene, const std::string& path);
+    // Converts a scene (e.g. read from XML with loadScene) into a binary scene file: the
+    // primitive tables and a binary BVH exactly as the renderer uses them, identical
+    // materials merged into one. Returns false if the file could not be written.
+
+    bool isSceneFile(const std::string& path);
+    // True if the file starts like a binary scene file
+
+    std::shared_ptr<const PreparedScene> openSceneFile(const std::string& path,
+                   std::vector<camera_description>& cameras,
+                   const RenderOptions& options = RenderOptions());
+    // Maps a binary scene file and renders from its tables in place; its BVH is used when
+    // the scene is big enough to need one (bvhThreshold), collapsed to 4 wide for bvhWidth 4.
+    // Fills in the cameras of the file. Returns null if the file is not a valid scene file
+    // of this version.
+
+    size_t primitiveCount(const PreparedScene& scene);
+    // Number of primitives of a prepared scene (boxes count as six quads)
+
+    class SceneGraph {
+        // Scene that stays prepared and is edited in place. Objects and materials have ids
+        // that do not change while the scene is edited. An edit only touches the
+        // primitives of the object or material concerned: added ones are inserted into the
+        // BVH leaf they grow the least and removed ones dropped from theirs, and only an
+        // overfull leaf is built again as a small subtree. Objects that keep their shape are
+        // changed in place and their leaves refitted by the commit: one by one (a primitive
+        // that left its leaf moves to a better one) when few moved, else the whole BVH at once
+        // in parallel, as for an animation frame (see refitCostLimit). The whole BVH is built
+        // again once the garbage left behind by the edits outweighs the live nodes. A render
+        // may go on while the scene is edited: the first edit after a commit whose scene is
+        // still held copies the geometry and the BVH and edits the copy. Edit and commit
+        // from one thread at a time.
+    public:
+        static constexpr uint32_t invalidId = 0xffffffff;
+
+        explicit SceneGraph(const RenderOptions& options = RenderOptions());
+        // Only bvhCacheDir (the first load may map a cached BVH), refitCostLimit and
+        // numThreads (for the refits) of the options are used
+
+        void load(const scene_description& scene);
+        // Makes the graph hold 'scene': the first load builds everything, later ones compare
+        // the scene with the graph and only apply the differences (object and material k of
+        // the scene are the ones with id k, the camera is the first one of the scene)
+
+        uint32_t addMaterial(const material_description& material);
+        bool setMaterial(uint32_t id, const material_description& material);
+        bool removeMaterial(uint32_t id);
+        // Fails while an object still uses the material
+
+        uint32_t addObject(const primitive_description& object);
+        // The material of the object is a material id; returns invalidId if it does not exist
+        bool setObject(uint32_t id, const primitive_description& object);
+        bool removeObject(uint32_t id);
+
+        void setCamera(const camera_description& camera);
+        camera_description camera() const;
+
+        std::shared_ptr<const PreparedScene> commit();
+        // Finishes the edits made since the last commit (lights, bounds, refits, a full rebuild
+        // if the BVH wore out) and returns the scene to render. Its hash only depends on what
+        // the scene holds (the live objects and materials by id), not on the edits that led
+        // there. Later edits change that same scene once nothing else holds it,
+        // until then they go to a copy.
+
+        struct State;
+    private:
+        std::shared_ptr<State> state;
+    };
+
+    void renderPreparedScene(const PreparedScene& scene,
+                   int vfov,
+                   const std::vector<double>& lookfrom,
+                   const std::vector<double>& lookat,
+                   const std::vector<double>& vup,
+                   int RenderType,
+                   const std::vector<double>& backGrounColor,
+                   const RenderOptions& options = RenderOptions());
+    // Renders a prepared scene from the given camera
+
+    void renderPreparedScene(const PreparedScene& scene,
+                   const camera_description& camera,
+                   int RenderType,
+                   const RenderOptions& options = RenderOptions());
+
+    struct Animation {
+        // Frame sequence rendered by renderAnimation. The sequence runs from time 0 to 1 and
+        // frame f of n shows time f / n.
+        int frames = 1;
+        double turntableDegrees = 0;
+        // The objects turn this many degrees over the sequence, about the up vector (vup) of
+        // the camera through its look-at point (360 makes a turntable that loops)
+        std::vector<double> flyTo;
+        // Camera position at the end of the sequence (empty keeps it still): the camera flies
+        // there in a straight line, keeping its view direction
+        bool motionBlur = false;
+        // Each frame blurs the motion of the spheres over its own shutter interval, from its
+        // time to the time of the next frame (without it every frame is sharp)
+    };
+
+    struct AnimationReport {
+        int frames = 0;
+        // Frames rendered (fewer than asked for if the render was cancelled)
+        int bvhRefits = 0;
+        int bvhRebuilds = 0;
+        // Frames whose whole BVH was refitted, and full rebuilds after the first build
+        double updateSeconds = 0;
+        // Time spent moving the objects and updating the BVH, the first build included
+        double renderSeconds = 0;
+    };
+
+    AnimationReport renderAnimation(const scene_description& scene,
+                   const Animation& animation,
+                   int RenderType,
+                   const RenderOptions& options = RenderOptions());
+    // Renders an animation of a typed scene from its first camera through a SceneGraph: the
+    // first frame builds the BVH, the next ones move the objects in place and refit it.
+    // Spheres with a second position move from the first to the second over the whole
+    // sequence, so each frame only bounds them where that frame sees them; boxes turn as
+    // their six sides. outputPath, hdrOutputPath, statsPath and checkpointPath name every
+    // frame: "{frame}" is replaced by the frame number in four digits, a name without it
+    // gets "_0000", "_0001", ... before its extension. partial and accumulation are not used.
+
     void traceRays(const std::vector<std::string>& shapeTypes,
                    const std::vector<std::vector<double>>& Colors,
                    const std::vector<std::vector<double>>& Colors2,
@@ -24,7 +340,55 @@ namespace RayTracing {
                    const std::vector<std::vector<double>>& Vect_1,
                    const std::vector<std::vector<double>>& Vect_2,
                    const std::vector<std::vector<double>>& Point_1,
-                   const std::vector<std::vector<double>>& Point_2);
+                   const std::vector<std::vector<double>>& Point_2,
+                   const RenderOptions& options = RenderOptions());
+
+    void traceRays(const scene_description& scene,
+                   int RenderType,
+                   const RenderOptions& options = RenderOptions());
+    // Builds and renders a typed scene from its first camera
+
+    RenderHandle traceRaysAsync(const std::vector<std::string>& shapeTypes,
+                   const std::vector<std::vector<double>>& Colors,
+                   const std::vector<std::vector<double>>& Colors2,
+                   const std::vector<std::string>& Materials,
+                   const std::vector<double>& Radio,
+                   const std::vector<std::vector<double>>& Position,
+                   const std::vector<std::vector<double>>& Position2,
+                   int vfov,
+                   const std::vector<double>& lookfrom,
+                   const std::vector<double>& lookat,
+                   const std::vector<double>& vup,
+                   int RenderType,
+                   const std::vector<double>& backGrounColor,
+                   const std::vector<std::vector<double>>& Origen,
+                   const std::vector<std::vector<double>>& Vect_1,
+                   const std::vector<std::vector<double>>& Vect_2,
+                   const std::vector<std::vector<double>>& Point_1,
+                   const std::vector<std::vector<double>>& Point_2,
+                   const RenderOptions& options = RenderOptions());
+    // Builds the scene on the calling thread, then renders it in the background
+
+    bool writeImage(const HdrImage& image, const std::string& path, const RenderOptions& options = RenderOptions());
+    // Writes a rendered frame again (only tonemap, exposure and gamma of the options are used),
+    // the format is given by the extension of path as for outputPath
+
+    bool readPfm(const std::string& path, HdrImage& image);
+    // Reads a PFM file, e.g. one written by a render, to tonemap it again
+
+    int imageHeight(const RenderOptions& options);
+    // Height in pixels of the image the options ask for
+    int samplesPerPixel(int RenderType, const RenderOptions& options);
+    // Samples per pixel of a render of this RenderType with these options
+
+    bool writePartialFrame(std::ostream& out, const PartialFrame& part);
+    bool readPartialFrame(std::istream& in, PartialFrame& part);
+    // Binary form of a partial frame, to send it from a worker process to the coordinator
+
+    bool mergePartialFrames(const std::vector<PartialFrame>& parts, HdrImage& image);
+    // Adds up the pieces of a frame, each pixel divided by the samples that reached it.
+    // Pieces may split the rows, the sample indices or both; returns false if they do not
+    // belong to the same frame or leave a row without samples.
 }
 
 #endif // RAY_TRACER_H
\ No newline at end of file
@@ -8,6 +8,8 @@
 // Include the hittable header file for hittable object representation
 #include "hittable_list.hpp"
 // Include the hittable list header file
+#include "render_stats.hpp"
+// Include the render stats header file for the hot path counters
 
 #include <algorithm>
 // Include the algorithm header file for STL algorithms
@@ -25,6 +27,7 @@ class bvh_node : public hittable {
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
         // Function to check if a ray hits the bounding volume hierarchy
+        RT_STAT(bvh_nodes_visited);
         if (!bbox.hit(r, ray_t))
         // If the ray does not hit the bounding box, return false
             return false;
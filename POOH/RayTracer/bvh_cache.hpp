@@ -0,0 +1,143 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include "flat_bvh.hpp"
+// Include the flat BVH header file for the hierarchy that is stored
+#include "hash.hpp"
+// Include the hash header file for the cache key
+#include "mapped_file.hpp"
+// Include the mapped file header file to use a cached hierarchy in place
+
+#include <cstdint>
+// Include the cstdint header file for the fixed width header fields
+#include <cstdio>
+// Include the cstdio header file to rename and delete the temporary file
+#include <cstring>
+// Include the cstring header file to check the magic
+#include <filesystem>
+// Include the filesystem header file to create the cache directory
+#include <fstream>
+// Include the fstream header file to write a cache entry
+#include <random>
+// Include the random header file for a unique temporary file name
+#include <string>
+// Include the string header file for the file names
+#include <system_error>
+// Include the system_error header file for the non-throwing filesystem calls
+
+struct bvh_cache_header {
+    // First bytes of a cached BVH
+    char magic[8];
+    // "RTBVH"
+    uint32_t version;
+    uint32_t byte_order;
+    // 0x01020304 in the byte order of the machine that wrote the file
+    uint64_t key;
+    // Cache key of the geometry the hierarchy was built over
+    uint64_t primitive_count;
+    uint64_t node_count;
+    uint64_t order_offset;
+    // The nodes start at nodes_offset, the primitive order at order_offset
+};
+
+class bvh_cache {
+    // Directory of prebuilt flat BVHs, one file per geometry, named after the hex cache key.
+    // The key hashes the primitive tables (materials excluded, they do not move anything)
+    // together with the builder settings, so a scene whose shapes did not change finds the
+    // hierarchy of an earlier run, whatever its camera or materials. A cached hierarchy is
+    // mapped and used in place like the one of a scene file. Entries are written to a
+    // temporary file that is then renamed, so a reader never sees half a file; two
+    // processes storing the same key write the same bytes.
+  public:
+    static constexpr uint32_t version = 1;
+    static constexpr uint32_t byte_order_mark = 0x01020304;
+    static constexpr uint64_t nodes_offset = 64;
+    // The node array starts after the header, 64 byte aligned
+
+    explicit bvh_cache(const std::string& directory) : dir(directory) {}
+
+    static uint64_t key(const scene_geometry& geometry) {
+        // Cache key of a geometry: its shape hash and everything that changes what the builder makes
+        fnv1a hash;
+        hash.add(geometry.shape_hash());
+        hash.add(flat_bvh::build_signature());
+        hash.add(sizeof(flat_bvh_node));
+        return hash.value;
+    }
+
+    std::string path(uint64_t cache_key) const {
+        // File of a key inside the cache directory
+        char name[32];
+        std::snprintf(name, sizeof name, "%016llx.rtbvh", static_cast<unsigned long long>(cache_key));
+        return (std::filesystem::path(dir) / name).string();
+    }
+
+    shared_ptr<flat_bvh> load(shared_ptr<const scene_geometry> geometry, uint64_t cache_key) const {
+        // The cached hierarchy of a geometry, null if there is none or it does not fit
+        auto file = make_shared<mapped_file>();
+        if (!file->open(path(cache_key)) || file->size() < nodes_offset)
+            return nullptr;
+        const bvh_cache_header* h = reinterpret_cast<const bvh_cache_header*>(file->data());
+        uint64_t node_bytes = h->node_count * sizeof(flat_bvh_node);
+        bool valid = std::memcmp(h->magic, "RTBVH", 6) == 0 && h->version == version &&
+                     h->byte_order == byte_order_mark && h->key == cache_key &&
+                     h->primitive_count == geometry->primitive_count() &&
+                     h->node_count <= (file->size() - nodes_offset) / sizeof(flat_bvh_node) &&
+                     h->order_offset >= nodes_offset + node_bytes && h->order_offset % sizeof(uint32_t) == 0 &&
+                     h->order_offset <= file->size() &&
+                     h->primitive_count <= (file->size() - h->order_offset) / sizeof(uint32_t);
+        if (!valid)
+            return nullptr;
+
+        table<flat_bvh_node> nodes;
+        nodes.attach(reinterpret_cast<flat_bvh_node*>(file->data() + nodes_offset), h->node_count);
+        table<uint32_t> order;
+        order.attach(reinterpret_cast<uint32_t*>(file->data() + h->order_offset), h->primitive_count);
+        if (!flat_bvh::valid_layout(nodes, order, geometry->primitive_count()))
+            return nullptr;
+        return make_shared<flat_bvh>(geometry, nodes, order, file);
+    }
+
+    bool store(const flat_bvh& bvh, uint64_t cache_key) const {
+        // Save a hierarchy under its key, returns false if the directory or file cannot be written
+        std::error_code error;
+        std::filesystem::create_directories(dir, error);
+        const table<flat_bvh_node>& nodes = bvh.node_array();
+        const table<uint32_t>& order = bvh.primitive_order();
+
+        bvh_cache_header header = {};
+        std::memcpy(header.magic, "RTBVH", 6);
+        header.version = version;
+        header.byte_order = byte_order_mark;
+        header.key = cache_key;
+        header.primitive_count = order.size();
+        header.node_count = nodes.size();
+        header.order_offset = nodes_offset + nodes.size() * sizeof(flat_bvh_node);
+
+        std::string final_path = path(cache_key);
+        std::string temporary_path = final_path + ".tmp" + std::to_string(std::random_device()());
+        std::ofstream out(temporary_path, std::ios::binary | std::ios::trunc);
+        const char zeros[nodes_offset] = {};
+        out.write(reinterpret_cast<const char*>(&header), sizeof header);
+        out.write(zeros, static_cast<std::streamsize>(nodes_offset - sizeof header));
+        out.write(reinterpret_cast<const char*>(nodes.data()), static_cast<std::streamsize>(nodes.size() * sizeof(flat_bvh_node)));
+        out.write(reinterpret_cast<const char*>(order.data()), static_cast<std::streamsize>(order.size() * sizeof(uint32_t)));
+        out.close();
+        if (!out) {
+            std::remove(temporary_path.c_str());
+            return false;
+        }
+        if (std::rename(temporary_path.c_str(), final_path.c_str()) != 0) {
+            // Windows does not replace an existing file: another render stored the same key first
+            std::remove(temporary_path.c_str());
+            return std::filesystem::exists(final_path, error);
+        }
+        return true;
+    }
+
+  private:
+    std::string dir;
+    // Directory holding the cache entries
+};
+
+#endif
@@ -1,11 +1,6 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION   
-// Define the STB_IMAGE_WRITE_IMPLEMENTATION macro
-#include "stb_image_write.h"             
-// Include the stb_image_write header file for writing images to disk
-
 #include "ray_tracing_common.hpp"
 // Include the ray tracing common header file for common ray tracing utilities
 
@@ -17,13 +12,49 @@
 // Include the clamp header file for clamping utility
 #include "material.hpp"
 // Include the material header file for material representation
+#include "tile_scheduler.hpp"
+// Include the tile scheduler header file for the tile based parallel render
+#include "ray_packet.hpp"
+// Include the ray packet header file for packet tracing of primary rays
+#include "light_list.hpp"
+// Include the light list header file for direct light sampling
+#include "frame_accumulator.hpp"
+// Include the frame accumulator header file for progressive rendering
+#include "render_progress.hpp"
+// Include the render progress header file for the progress counters
+#include "framebuffer.hpp"
+// Include the framebuffer header file for the linear float image
+#include "image_io.hpp"
+// Include the image io header file for the PNG, PFM and EXR output
+#include "checkpoint.hpp"
+// Include the checkpoint header file to save and resume progressive renders
+#include "hash.hpp"
+// Include the hash header file for the checkpoint key
+#include "render_stats.hpp"
+// Include the render stats header file for the counters and phase timings
 
 #include <iostream>                 
 // Include the standard input-output stream library for console I/O
 #include <vector>                   
 // Include the vector container from the standard template library (STL)
+#include <atomic>
+// Include the atomic header file for the cancellation flag
+#include <chrono>
+// Include the chrono header file to time the checkpoints
+#include <functional>
+// Include the functional header file for the pass callback
+#include <string>
+// Include the string header file for the output path
 #include <omp.h>  
 
+enum class integrator_mode {
+    bsdf,
+    // Paths only find the lights by bouncing into them
+    light_sampling
+    // Next event estimation: a shadow ray toward a light at every diffuse bounce,
+    // combined with the bounces through multiple importance sampling
+};
+
 class camera {
   public:
     double aspect_ratio = 1.0;
@@ -51,32 +82,77 @@ class camera {
     double focus_dist = 10;    
     // Distance from camera lookfrom point to plane of perfect focus
 
+    int num_threads = 0;
+    // Number of render threads (0 uses every hardware thread)
+    int tile_size = 16;
+    // Side length in pixels of the square tiles handed to the render threads
+    tile_order order = tile_order::morton;
+    // Order in which the tiles are queued
+    uint64_t seed = 0;
+    // Seed of the sample generators, the same seed always gives the same image
+    int packet_size = 0;
+    // Primary rays traced together as packets of 4 or 8 (0 traces them one at a time)
+    int roulette_depth = 3;
+    // Bounces before Russian roulette may end a path (negative disables it)
+    integrator_mode integrator = integrator_mode::bsdf;
+    // How the paths gather light
+    const light_list* lights = nullptr;
+    // Lights sampled by the light_sampling integrator (owned by the scene)
+
+    double adaptive_threshold = 0;
+    // Adaptive sampling: a pixel stops once the standard error of its mean luminance is
+    // below this fraction of the mean (0 always takes samples_per_pixel samples)
+    int adaptive_min_samples = 0;
+    // Samples every pixel takes before its noise is first checked (0 means a quarter of
+    // samples_per_pixel). Too few lets pixels lit by rare paths stop while still black
+    int adaptive_max_samples = 0;
+    // Samples a noisy pixel may take (0 means four times samples_per_pixel)
+    uint64_t samples_taken = 0;
+    // Samples traced by the last render
+    std::string output_path = "C:\\Users\\natyo\\OneDrive - Universidad EIA\\Escritorio\\POOH\\RayTracer\\output.png";
+    // Image written at the end of a render: .exr and .pfm keep the linear radiance,
+    // anything else is written as a tonemapped PNG
+    std::string hdr_output_path;
+    // Second file written next to output_path, normally an .exr or .pfm (empty writes none)
+    tone_mapping tone;
+    // Exposure, curve and gamma used for the 8 bit output
+    framebuffer frame;
+    // Linear radiance of the last render, kept to tonemap it again without rendering
+    render_progress* progress = nullptr;
+    // Progress counters updated after every tile, its cancel flag stops the render (optional)
+    const std::atomic<bool>* cancel = nullptr;
+    // Another flag that stops the render when set (optional)
+    render_stats* stats = nullptr;
+    // Filled with the counters and phase timings of the render (optional)
+    std::string checkpoint_path;
+    // File a progressive render saves its accumulation to and resumes from (empty saves none)
+    double checkpoint_interval = 60;
+    // Seconds between two checkpoints
+    uint64_t scene_key = 0;
+    // Fingerprint of the scene, so a checkpoint is never resumed on another scene
+
     void rende2(const hittable& world) {
         initialize();
         // Initialize the camera
 
         // Create a buffer to store the image data
-        std::vector<unsigned char> image_buffer(image_width * image_height * 3); 
-        // Create a vector to hold pixel data
-        // The size is calculated based on width, height, and 3 channels (RGB)
-
-        // Progress indicator
-        // Print the message indicating the start of the rendering process
+        frame.resize(image_width, image_height);
+        // The frame holds four floats (RGBA) per pixel
 
         // Fill the image buffer with pixel data
         for (int j = 0; j < image_height; ++j) {  
         // Iterate through each row of the image
-            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush; 
-            // Print the progress indicator for the current scanline
             for (int i = 0; i < image_width; ++i) {  
             // Iterate through each column (pixel) of the image
                 color pixel_color(0, 0, 0);
                 // Initialize the color of the current pixel to black
                 for (int sample = 0; sample < samples_per_pixel; ++sample) {
                 // Iterate through each sample per pixel
-                    ray r = get_ray(i, j);
+                    sampler rng(seed, static_cast<uint64_t>(j) * image_width + i, sample);
+                    // Random number generator of this sample
+                    ray r = get_ray(i, j, rng);
                     // Create a ray from the camera center to the current pixel
-                    pixel_color += ray_color(r, max_depth, world);
+                    pixel_color += ray_color(r, max_depth, world, rng);
                     // Calculate the color of the current pixel
                 }
                 // write_color(std::cout, pixel_color, samples_per_pixel);
@@ -85,54 +161,196 @@ class camera {
                 pixel_color /= samples_per_pixel;
 
                 // Write the color to the buffer
-                image_buffer[(j * image_width + i) * 3 + 0] = static_cast<unsigned char>(255.999 * clamp(pixel_color.x(), 0.0, 1.0));
-                // Store the clamped red component of the current pixel in the image buffer
-                image_buffer[(j * image_width + i) * 3 + 1] = static_cast<unsigned char>(255.999 * clamp(pixel_color.y(), 0.0, 1.0));
-                // Store the clamped green component of the current pixel in the image buffer
-                image_buffer[(j * image_width + i) * 3 + 2] = static_cast<unsigned char>(255.999 * clamp(pixel_color.z(), 0.0, 1.0));
-                // Store the clamped blue component of the current pixel in the image buffer
+                frame.set(i, j, pixel_color);
+                // Store the linear color of the current pixel in the frame
             }
         }
 
-        // Write the image to a PNG file using stb_image_write.h
-        stbi_write_png("C:\\Users\\natyo\\OneDrive - Universidad EIA\\Escritorio\\POOH\\RayTracer\\output.png", image_width, image_height, 3, image_buffer.data(), image_width * 3); 
-        // Write the image data to a PNG file
-
-        // Progress indicator
-        std::clog << "\rRendering completed!         \n";  
-        // Print the completion message indicating the end of the rendering process
+        // Write the image to output_path
+        write_image();
     }
 
-    void render(const hittable& world) {
+    bool render(const hittable& world) {
+        // Render the image and write it to output_path. Returns false, without writing
+        // anything, if the render was cancelled.
         initialize();
-        std::vector<unsigned char> image_buffer(image_width * image_height * 3); 
-
-        std::clog << "Rendering Progress:\n";   
-        int num_threads = 4;  // Specify the number of threads you want to use
-        omp_set_num_threads(num_threads);  // Set the number of threads
+        frame.resize(image_width, image_height);
+
+        int threads = (num_threads > 0) ? num_threads : omp_get_max_threads();
+        // Use every hardware thread unless a thread count was requested
+        tile_scheduler scheduler(image_width, image_height, tile_size, order, threads);
+        if (progress)
+            progress->tiles_total = scheduler.tile_count();
+
+        // A single parallel region for the whole frame: the threads keep pulling
+        // tiles from the scheduler until the image is done (or the render is cancelled).
+        uint64_t samples = 0;
+        auto trace_start = std::chrono::steady_clock::now();
+        #pragma omp parallel num_threads(threads) reduction(+:samples)
+        {
+            begin_thread_stats();
+            int worker = omp_get_thread_num();
+            tile t;
+            while (!cancelled() && scheduler.next(worker, t)) {
+                ray_counter() = 0;
+                uint64_t tile_samples = render_tile(t, world);
+                samples += tile_samples;
+                report_tile(tile_samples);
+            }
+            end_thread_stats();
+        }
+        add_trace_time(trace_start);
+        samples_taken = samples;
 
-        
-        for (int j = 0; j < image_height; ++j) {  
-            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush; 
-            #pragma omp parallel for schedule(dynamic, 1) // OpenMP
-            for (int i = 0; i < image_width; ++i) {  
-                color pixel_color(0, 0, 0);
-                for (int sample = 0; sample < samples_per_pixel; ++sample) {
-                    ray r = get_ray(i, j);
-                    pixel_color += ray_color(r, max_depth, world);
-                }
+        if (cancelled())
+            return false;
+        write_image();
+        return true;
+    }
 
-                pixel_color /= samples_per_pixel;
+    bool render_progressive(const hittable& world, frame_accumulator& accumulator, int samples_per_pass,
+                            const std::function<void(const frame_accumulator&)>& on_pass = nullptr) {
+        // Render in passes until 'accumulator' holds samples_per_pixel samples per pixel.
+        // The first pass takes a single sample so a preview is ready almost at once, the
+        // next ones samples_per_pass each. After every pass on_pass is called, from the
+        // calling thread, with the accumulation so far. A cancel stops the threads after
+        // their current tile and drops the unfinished pass; calling again with the same
+        // accumulator (and the same camera and seed) resumes the render. Sample k of a
+        // pixel is keyed by k whatever the pass it falls in. Returns true once the
+        // accumulation is complete.
+        // With a checkpoint_path the accumulation is also saved every checkpoint_interval
+        // seconds and when the render stops early, and a render of the same scene, camera,
+        // seed and pass size picks it up from there: the passes that follow are the ones an
+        // uninterrupted render would have traced, so the result is the same bit for bit.
+        // The checkpoint is deleted once the render is complete.
+        initialize();
+        if (!accumulator.matches(image_width, image_height))
+            accumulator.reset(image_width, image_height);
+        if (samples_per_pass < 1)
+            samples_per_pass = 1;
+
+        checkpoint_file checkpoint;
+        bool checkpointing = false;
+        if (!checkpoint_path.empty()) {
+            checkpointing = checkpoint.open(checkpoint_path, checkpoint_key(samples_per_pass),
+                                            image_width, image_height, samples_per_pass);
+            if (!checkpointing)
+                std::cerr << "Could not open checkpoint " << checkpoint_path << '\n';
+            else if (checkpoint.samples() > accumulator.samples && checkpoint.samples() <= samples_per_pixel)
+                checkpoint.load(accumulator);
+        }
+        int saved_samples = accumulator.samples;
+        auto last_save = std::chrono::steady_clock::now();
+
+        int threads = (num_threads > 0) ? num_threads : omp_get_max_threads();
+        // Use every hardware thread unless a thread count was requested
+        samples_taken = 0;
+
+        if (progress) {
+            int passes = 0;
+            for (int done = accumulator.samples; done < samples_per_pixel; done += (done == 0) ? 1 : samples_per_pass)
+                passes++;
+            tile_scheduler counter(image_width, image_height, tile_size, order, 1);
+            progress->tiles_total = static_cast<uint64_t>(counter.tile_count()) * passes;
+        }
 
-                image_buffer[(j * image_width + i) * 3 + 0] = static_cast<unsigned char>(255.999 * clamp(pixel_color.x(), 0.0, 1.0));
-                image_buffer[(j * image_width + i) * 3 + 1] = static_cast<unsigned char>(255.999 * clamp(pixel_color.y(), 0.0, 1.0));
-                image_buffer[(j * image_width + i) * 3 + 2] = static_cast<unsigned char>(255.999 * clamp(pixel_color.z(), 0.0, 1.0));
+        std::vector<float> pass_sum(accumulator.sum.size());
+        // Samples of the current pass, only added to the accumulation once the pass is whole
+
+        while (accumulator.samples < samples_per_pixel && !cancelled()) {
+            int first = accumulator.samples;
+            int count = (first == 0) ? 1 : samples_per_pass;
+            if (count > samples_per_pixel - first)
+                count = samples_per_pixel - first;
+
+            tile_scheduler scheduler(image_width, image_height, tile_size, order, threads);
+            auto trace_start = std::chrono::steady_clock::now();
+            #pragma omp parallel num_threads(threads)
+            {
+                begin_thread_stats();
+                int worker = omp_get_thread_num();
+                tile t;
+                while (!cancelled() && scheduler.next(worker, t)) {
+                    ray_counter() = 0;
+                    render_tile_pass(t, world, pass_sum, first, count);
+                    report_tile(static_cast<uint64_t>(t.x1 - t.x0) * (t.y1 - t.y0) * count);
+                }
+                end_thread_stats();
+            }
+            add_trace_time(trace_start);
+            if (cancelled())
+                break;
+
+            for (size_t k = 0; k < pass_sum.size(); ++k)
+                accumulator.sum[k] += pass_sum[k];
+            accumulator.samples += count;
+            samples_taken += static_cast<uint64_t>(image_width) * image_height * count;
+            if (on_pass)
+                on_pass(accumulator);
+
+            auto now = std::chrono::steady_clock::now();
+            if (checkpointing && accumulator.samples < samples_per_pixel &&
+                std::chrono::duration<double>(now - last_save).count() >= checkpoint_interval) {
+                checkpoint.save(accumulator);
+                saved_samples = accumulator.samples;
+                last_save = now;
             }
         }
 
-        stbi_write_png("C:\\Users\\natyo\\OneDrive - Universidad EIA\\Escritorio\\POOH\\RayTracer\\output.png", image_width, image_height, 3, image_buffer.data(), image_width * 3); 
+        if (checkpointing) {
+            if (accumulator.samples >= samples_per_pixel)
+                checkpoint.remove();
+            else if (accumulator.samples > saved_samples)
+                checkpoint.save(accumulator);
+        }
 
-        std::clog << "\rRendering completed!         \n";  
+        accumulator.resolve(frame);
+        write_image();
+        return accumulator.samples >= samples_per_pixel;
+    }
+
+    bool render_partial(const hittable& world, int first_row, int end_row, int first_sample, int end_sample,
+                        std::vector<float>& sum) {
+        // Piece of a frame split between several processes: the sum of samples
+        // first_sample .. end_sample - 1 of every pixel of rows first_row .. end_row - 1,
+        // three floats per pixel, nothing written to disk. Since sample k of a pixel always
+        // comes from the generator keyed by k, the pieces add up to the samples one render
+        // of the whole frame would take. Returns false if the render was cancelled.
+        initialize();
+        first_row = clamp(first_row, 0, image_height);
+        end_row = clamp(end_row, first_row, image_height);
+        sum.assign(static_cast<size_t>(end_row - first_row) * image_width * 3, 0.0f);
+        if (end_row == first_row || end_sample <= first_sample)
+            return true;
+
+        int threads = (num_threads > 0) ? num_threads : omp_get_max_threads();
+        // Use every hardware thread unless a thread count was requested
+        tile_scheduler scheduler(image_width, end_row - first_row, tile_size, order, threads);
+        if (progress)
+            progress->tiles_total = scheduler.tile_count();
+
+        int count = end_sample - first_sample;
+        uint64_t samples = 0;
+        auto trace_start = std::chrono::steady_clock::now();
+        #pragma omp parallel num_threads(threads) reduction(+:samples)
+        {
+            begin_thread_stats();
+            int worker = omp_get_thread_num();
+            tile t;
+            while (!cancelled() && scheduler.next(worker, t)) {
+                t.y0 += first_row;
+                t.y1 += first_row;
+                ray_counter() = 0;
+                render_tile_pass(t, world, sum, first_sample, count, first_row);
+                uint64_t tile_samples = static_cast<uint64_t>(t.x1 - t.x0) * (t.y1 - t.y0) * count;
+                samples += tile_samples;
+                report_tile(tile_samples);
+            }
+            end_thread_stats();
+        }
+        add_trace_time(trace_start);
+        samples_taken = samples;
+        return !cancelled();
     }
 
   private:
@@ -154,7 +372,7 @@ class camera {
     // Defocus disk vertical radius
 
     void initialize() {
-        image_height = static_cast<int>(image_width / aspect_ratio);
+        image_height = static_cast<int>(image_width / aspect_ratio + 1e-6);
         // Calculate the height of the image based on the aspect ratio
         image_height = (image_height < 1) ? 1 : image_height;
         // Ensure the height is at least 1 pixel
@@ -202,45 +420,256 @@ class camera {
         // Calculate the vertical radius of the defocus disk
     }
 
-    ray get_ray(int i, int j) const {
+    uint64_t render_tile(const tile& t, const hittable& world) {
+        // Render every pixel of the tile into the frame, returns the samples traced
+        if (packet_size > 1 && adaptive_threshold <= 0)
+            return render_tile_packets(t, world);
+        // Packets trace a fixed number of samples in lockstep, adaptive sampling goes ray by ray
+
+        uint64_t samples = 0;
+        for (int j = t.y0; j < t.y1; ++j) {
+            for (int i = t.x0; i < t.x1; ++i) {
+                int pixel_samples;
+                color pixel_color = (adaptive_threshold > 0) ? render_pixel_adaptive(i, j, world, pixel_samples)
+                                                             : render_pixel(i, j, world, pixel_samples);
+                samples += pixel_samples;
+                frame.set(i, j, pixel_color);
+            }
+        }
+        return samples;
+    }
+
+    void render_tile_pass(const tile& t, const hittable& world, std::vector<float>& pass_sum, int first_sample, int count,
+                          int first_row = 0) const {
+        // Sum of samples first_sample .. first_sample + count - 1 of every pixel of the tile,
+        // stored in pass_sum as if its first row were image row first_row
+        for (int j = t.y0; j < t.y1; ++j) {
+            for (int i = t.x0; i < t.x1; ++i) {
+                color sample_sum(0, 0, 0);
+                for (int sample = first_sample; sample < first_sample + count; ++sample) {
+                    sampler rng(seed, static_cast<uint64_t>(j) * image_width + i, sample);
+                    ray r = get_ray(i, j, rng);
+                    sample_sum += ray_color(r, max_depth, world, rng);
+                }
+                size_t index = (static_cast<size_t>(j - first_row) * image_width + i) * 3;
+                pass_sum[index + 0] = static_cast<float>(sample_sum.x());
+                pass_sum[index + 1] = static_cast<float>(sample_sum.y());
+                pass_sum[index + 2] = static_cast<float>(sample_sum.z());
+            }
+        }
+    }
+
+    bool cancelled() const {
+        // True once either cancel flag is set
+        return (cancel && cancel->load(std::memory_order_relaxed)) ||
+               (progress && progress->cancel.load(std::memory_order_relaxed));
+    }
+
+    static uint64_t& ray_counter() {
+        // Rays traced by this thread in its current tile, published by report_tile
+        static thread_local uint64_t rays = 0;
+        return rays;
+    }
+
+    void report_tile(uint64_t samples) const {
+        // Publish the progress of a finished tile
+        if (!progress)
+            return;
+        progress->tiles_done.fetch_add(1, std::memory_order_relaxed);
+        progress->samples_done.fetch_add(samples, std::memory_order_relaxed);
+        progress->rays_traced.fetch_add(ray_counter(), std::memory_order_relaxed);
+    }
+
+    uint64_t checkpoint_key(int samples_per_pass) const {
+        // Everything that decides which value sample k of a pixel takes
+        fnv1a key;
+        key.add(scene_key);
+        key.add(seed);
+        key.add(image_width);
+        key.add(image_height);
+        key.add(samples_per_pass);
+        key.add(max_depth);
+        key.add(roulette_depth);
+        key.add(integrator);
+        key.add(background);
+        key.add(vfov);
+        key.add(lookfrom);
+        key.add(lookat);
+        key.add(vup);
+        key.add(defocus_angle);
+        key.add(focus_dist);
+        return key.value;
+    }
+
+    void write_image() const {
+        // Write the frame to output_path, and to hdr_output_path if one is set
+        auto write_start = std::chrono::steady_clock::now();
+        if (!image_io::write_image(output_path, frame, tone))
+            std::cerr << "Could not write " << output_path << '\n';
+        if (!hdr_output_path.empty() && !image_io::write_image(hdr_output_path, frame, tone))
+            std::cerr << "Could not write " << hdr_output_path << '\n';
+        if (stats)
+            stats->write_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - write_start).count();
+    }
+
+    void begin_thread_stats() const {
+        // Start the counters of this render thread from zero
+        if (stats)
+            thread_counters() = render_counters();
+    }
+
+    void end_thread_stats() const {
+        // Hand the counters of this render thread over to the render, once per parallel region
+        if (stats)
+            stats->gather();
+    }
+
+    void add_trace_time(std::chrono::steady_clock::time_point start) const {
+        // Add the time since 'start' to the tracing phase
+        if (stats)
+            stats->trace_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    color render_pixel(int i, int j, const hittable& world, int& samples) const {
+        // Average of samples_per_pixel samples of pixel i,j
+        color pixel_color(0, 0, 0);
+        for (int sample = 0; sample < samples_per_pixel; ++sample) {
+            sampler rng(seed, static_cast<uint64_t>(j) * image_width + i, sample);
+            ray r = get_ray(i, j, rng);
+            pixel_color += ray_color(r, max_depth, world, rng);
+        }
+        samples = samples_per_pixel;
+        return pixel_color / samples_per_pixel;
+    }
+
+    color render_pixel_adaptive(int i, int j, const hittable& world, int& samples) const {
+        // Average of pixel i,j, sampled until its mean luminance is known well enough.
+        // The running mean and variance of the luminance are updated with Welford's method;
+        // the noise is checked after every batch of samples, from adaptive_min_samples on.
+        // Sample k of a pixel always uses the generator keyed by k, so the result still
+        // only depends on the seed.
+        const int batch = 8;
+        int max_samples = (adaptive_max_samples > 0) ? adaptive_max_samples : 4 * samples_per_pixel;
+        int min_samples = (adaptive_min_samples > 0) ? adaptive_min_samples : samples_per_pixel / 4;
+        if (min_samples < 2)
+            min_samples = 2;
+        if (min_samples > max_samples)
+            min_samples = max_samples;
+
+        color sum(0, 0, 0);
+        double mean = 0;
+        // Running mean of the sample luminance
+        double m2 = 0;
+        // Running sum of squared deviations from the mean
+        int n = 0;
+
+        while (n < max_samples) {
+            int next_check = (n < min_samples) ? min_samples : n + batch;
+            if (next_check > max_samples)
+                next_check = max_samples;
+            for (; n < next_check; ++n) {
+                sampler rng(seed, static_cast<uint64_t>(j) * image_width + i, n);
+                ray r = get_ray(i, j, rng);
+                color c = ray_color(r, max_depth, world, rng);
+                sum += c;
+
+                double y = 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+                double delta = y - mean;
+                mean += delta / (n + 1);
+                m2 += delta * (y - mean);
+            }
+
+            if (n < 2)
+                continue;
+            double standard_error = sqrt(m2 / (n - 1) / n);
+            if (standard_error <= adaptive_threshold * fmax(mean, 1.0 / 256))
+            // Dark pixels are judged against one display level, not against their own mean
+                break;
+        }
+
+        samples = n;
+        return sum / n;
+    }
+
+    uint64_t render_tile_packets(const tile& t, const hittable& world) {
+        // Same as render_tile, but the primary rays of 'packet_size' neighbouring pixels
+        // of a row go through the scene together. Every pixel keeps its own samplers,
+        // so the image matches the one traced ray by ray.
+        int width = (packet_size < ray_packet::max_size) ? packet_size : ray_packet::max_size;
+
+        for (int j = t.y0; j < t.y1; ++j) {
+            for (int i0 = t.x0; i0 < t.x1; i0 += width) {
+                int count = (t.x1 - i0 < width) ? t.x1 - i0 : width;
+                color pixel_colors[ray_packet::max_size];
+                sampler rngs[ray_packet::max_size];
+                ray rays[ray_packet::max_size];
+                hit_record recs[ray_packet::max_size];
+                bool hits[ray_packet::max_size];
+
+                for (int sample = 0; sample < samples_per_pixel; ++sample) {
+                    for (int k = 0; k < count; ++k) {
+                        rngs[k] = sampler(seed, static_cast<uint64_t>(j) * image_width + i0 + k, sample);
+                        rays[k] = get_ray(i0 + k, j, rngs[k]);
+                    }
+
+                    world.hit_packet(rays, count, interval(0.001, infinity), recs, hits);
+                    ray_counter() += count;
+
+                    for (int k = 0; k < count; ++k) {
+                        if (max_depth <= 0)
+                            continue;
+                        pixel_colors[k] += hits[k] ? shade(rays[k], recs[k], max_depth, world, rngs[k]) : background;
+                    }
+                }
+
+                for (int k = 0; k < count; ++k) {
+                    frame.set(i0 + k, j, pixel_colors[k] / samples_per_pixel);
+                }
+            }
+        }
+        return static_cast<uint64_t>(t.x1 - t.x0) * (t.y1 - t.y0) * samples_per_pixel;
+    }
+
+    ray get_ray(int i, int j, sampler& rng) const {
     // Get a randomly sampled camera ray for the pixel at location i,j, 
     // originating from the camera defocus disk and passing through the pixel
 
         auto pixel_center = pixel00_loc + (i * pixel_delta_u) + (j * pixel_delta_v);
         // Calculate the center of the pixel
-        auto pixel_sample = pixel_center + pixel_sample_square();
+        auto pixel_sample = pixel_center + pixel_sample_square(rng);
         // Calculate a random point in the pixel
 
-        auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
+        auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample(rng);
         // Set the ray origin to the center of the camera if defocus is disabled
         auto ray_direction = pixel_sample - ray_origin;
         // Set the ray direction to the point in the pixel
 
-        auto ray_time = random_double();
+        auto ray_time = random_double(rng);
         // Set the ray time to a random value
 
+        RT_STAT(primary_rays);
         return ray(ray_origin, ray_direction, ray_time);
         // Return the ray from the camera origin to the pixel
     }
 
-    point3 defocus_disk_sample() const {
+    point3 defocus_disk_sample(sampler& rng) const {
     // Returns a random point in the camera defocus disk
-        auto p = random_in_unit_disk();
+        auto p = random_in_unit_disk(rng);
         // Generate a random point in the unit disk
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 
-    vec3 pixel_sample_square() const {
+    vec3 pixel_sample_square(sampler& rng) const {
     // Returns a random point in the square surrounding a pixel at the origin
-        auto px = -0.5 + random_double();
+        auto px = -0.5 + random_double(rng);
         // Randomly sample a point in the range [-0.5, 0.5]
-        auto py = -0.5 + random_double();
+        auto py = -0.5 + random_double(rng);
         // Randomly sample a point in the range [-0.5, 0.5]
         return (px * pixel_delta_u) + (py * pixel_delta_v);
         // Return the point in the square surrounding the pixel
     }
 
-    color ray_color(const ray& r, int depth, const hittable& world) const {
+    color ray_color(const ray& r, int depth, const hittable& world, sampler& rng) const {
         hit_record rec;
 
         // If we've exceeded the ray bounce limit, no more light is gathered.
@@ -248,26 +677,109 @@ class camera {
             return color(0,0,0);
 
         // If the ray hits nothing, return the background color.
+        ++ray_counter();
         if (!world.hit(r, interval(0.001, infinity), rec))
             return background;
 
-        ray scattered;
-        // Ray scattered from the hit point
-        color attenuation;
-        // Attenuation factor of the scattered ray
-        color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
-        // Emitted color from the hit point
+        return shade(r, rec, depth, world, rng);
+    }
 
-        if (!rec.mat->scatter(r, rec, attenuation, scattered))
-        // If the ray is not scattered
-            return color_from_emission;
-            // Return the emitted color
+    color shade(const ray& r_in, const hit_record& first_hit, int depth, const hittable& world, sampler& rng) const {
+        // Light carried back along r_in from its hit point first_hit. The path is followed
+        // bounce after bounce in a loop: 'throughput' is the product of the attenuations
+        // met so far, so the stack use does not depend on max_depth.
+        color radiance(0,0,0);
+        // Light gathered along the path
+        color throughput(1,1,1);
+        // Fraction of the light at the current vertex that reaches the camera
+        ray r = r_in;
+        hit_record rec = first_hit;
+        bool sample_lights = integrator == integrator_mode::light_sampling && lights && !lights->empty();
+        double bounce_pdf = 0;
+        // Density of the last bounce direction, 0 after the camera or a specular bounce
+
+        for (int bounce = 1; ; ++bounce) {
+            color emission = rec.mat->emitted(rec.u, rec.v, rec.p);
+            // Emitted color from the hit point
+            if (sample_lights && bounce_pdf > 0 && rec.mat->is_emissive()) {
+                // The light could also have been reached by the shadow ray of the last
+                // vertex: weight the two strategies with the power heuristic
+                double light_pdf = lights->pdf(r, rec.t);
+                emission *= power_heuristic(bounce_pdf, light_pdf);
+            }
+            radiance += throughput * emission;
+
+            ray scattered;
+            // Ray scattered from the hit point
+            color attenuation;
+            // Attenuation factor of the scattered ray
+            if (!rec.mat->scatter(r, rec, attenuation, scattered, rng))
+                break;
+            if (bounce >= depth)
+                break;
+            // Bounce limit reached, no more light is gathered
+
+            bounce_pdf = sample_lights ? rec.mat->scattering_pdf(r, rec, scattered) : 0;
+            if (bounce_pdf > 0)
+                radiance += throughput * sample_direct_light(r, rec, attenuation, world, rng);
+
+            throughput = throughput * attenuation;
+
+            if (roulette_depth >= 0 && bounce > roulette_depth) {
+                // Russian roulette: end the path with a probability that grows as its
+                // throughput drops, and scale the survivors so the estimate stays unbiased
+                double survive = fmin(1.0, fmax(throughput.x(), fmax(throughput.y(), throughput.z())));
+                if (survive <= 0 || random_double(rng) >= survive) {
+                    RT_STAT(roulette_terminations);
+                    break;
+                }
+                throughput /= survive;
+            }
 
-        color color_from_scatter = attenuation * ray_color(scattered, depth-1, world);
-        // Color from the scattered ray
+            r = scattered;
+            ++ray_counter();
+            RT_STAT(secondary_rays);
+            if (!world.hit(r, interval(0.001, infinity), rec)) {
+                radiance += throughput * background;
+                break;
+            }
+        }
+
+        return radiance;
+    }
+
+    color sample_direct_light(const ray& r_in, const hit_record& rec, const color& attenuation,
+                              const hittable& world, sampler& rng) const {
+        // Light reaching the hit point straight from a sampled light point, through a
+        // shadow ray, weighted against the bounce strategy with the power heuristic
+        light_sample s;
+        if (!lights->sample(rec.p, r_in.time(), rng, s) || s.pdf <= 0)
+            return color(0,0,0);
+
+        ray shadow(rec.p, s.direction, r_in.time());
+        double bsdf_pdf = rec.mat->scattering_pdf(r_in, rec, shadow);
+        if (bsdf_pdf <= 0)
+            return color(0,0,0);
+        // The light is behind the surface
+
+        hit_record blocker;
+        ++ray_counter();
+        RT_STAT(shadow_rays);
+        double epsilon = 0.001 / s.direction.length();
+        // The shadow ray runs from t = 0 at the hit point to t = 1 at the light point: skip the
+        // same 0.001 units at both ends as the other rays, whatever the distance to the light
+        if (world.hit(shadow, interval(epsilon, 1 - epsilon), blocker))
+            return color(0,0,0);
+        // Something stands between the hit point and the light
+
+        return attenuation * s.emission * (bsdf_pdf * power_heuristic(s.pdf, bsdf_pdf) / s.pdf);
+    }
 
-        return color_from_emission + color_from_scatter;
-        // Return the sum of the emitted and scattered colors
+    static double power_heuristic(double pdf, double other_pdf) {
+        // Multiple importance sampling weight of a strategy against the other one
+        double a = pdf * pdf;
+        double b = other_pdf * other_pdf;
+        return (a + b > 0) ? a / (a + b) : 0;
     }
 };
 
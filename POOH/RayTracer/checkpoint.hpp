@@ -0,0 +1,219 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "frame_accumulator.hpp"
+// Include the frame accumulator header file for the accumulation that is saved
+
+#include <cstdint>
+// Include the cstdint header file for the fixed width header fields
+#include <cstdio>
+// Include the cstdio header file to delete a finished checkpoint
+#include <cstring>
+// Include the cstring header file to copy in and out of the mapping
+#include <string>
+// Include the string header file for the file name
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct checkpoint_header {
+    // First bytes of a checkpoint file
+    char magic[8];
+    // "RTCKPT1"
+    uint32_t version;
+    uint32_t active;
+    // Slot holding the latest complete accumulation (0 or 1)
+    uint64_t key;
+    // Fingerprint of the scene, camera, seed and pass size the samples belong to
+    int32_t width;
+    int32_t height;
+    int32_t samples[2];
+    // Samples per pixel accumulated in each slot
+    int32_t samples_per_pass;
+    int32_t reserved;
+};
+
+class checkpoint_file {
+    // Binary checkpoint of a progressive render, mapped in memory. The file holds a header
+    // and two slots, each the float sum of every pixel. A save copies the accumulation into
+    // the slot that is not active, flushes it, then flips 'active' in the header: a crash
+    // at any moment leaves at least one complete slot. Since sample k of a pixel is always
+    // drawn from the generator keyed by (seed, pixel, k), the sample count is all the
+    // generator state there is to save.
+  public:
+    static constexpr uint32_t version = 1;
+    static constexpr size_t data_offset = 64;
+    // Slots start after the header, 64 byte aligned
+
+    checkpoint_file() = default;
+    checkpoint_file(const checkpoint_file&) = delete;
+    checkpoint_file& operator=(const checkpoint_file&) = delete;
+    ~checkpoint_file() { close(); }
+
+    bool open(const std::string& file_path, uint64_t key, int width, int height, int samples_per_pass) {
+        // Map the checkpoint at file_path, creating it (or starting it over if it belongs to
+        // another render) as needed. Returns false if the file cannot be mapped.
+        close();
+        path = file_path;
+        slot_floats = static_cast<size_t>(width) * height * 3;
+        size = data_offset + 2 * slot_floats * sizeof(float);
+
+        bool existing = map(path, size);
+        if (!data)
+            return false;
+
+        checkpoint_header* h = header();
+        bool valid = existing && std::memcmp(h->magic, "RTCKPT1", 8) == 0 && h->version == version &&
+                     h->key == key && h->width == width && h->height == height &&
+                     h->samples_per_pass == samples_per_pass && h->active < 2;
+        if (!valid) {
+            std::memset(h, 0, sizeof(checkpoint_header));
+            std::memcpy(h->magic, "RTCKPT1", 8);
+            h->version = version;
+            h->key = key;
+            h->width = width;
+            h->height = height;
+            h->samples_per_pass = samples_per_pass;
+            flush(0, sizeof(checkpoint_header));
+        }
+        return true;
+    }
+
+    int samples() const {
+        // Samples per pixel of the latest saved accumulation (0 if nothing was saved yet)
+        return data ? header()->samples[header()->active] : 0;
+    }
+
+    void load(frame_accumulator& accumulator) const {
+        // Copy the latest saved accumulation into 'accumulator'
+        const checkpoint_header* h = header();
+        accumulator.reset(h->width, h->height);
+        accumulator.samples = h->samples[h->active];
+        std::memcpy(accumulator.sum.data(), slot(h->active), slot_floats * sizeof(float));
+    }
+
+    void save(const frame_accumulator& accumulator) {
+        // Write the accumulation into the inactive slot, then make it the active one
+        checkpoint_header* h = header();
+        uint32_t next = 1 - h->active;
+        std::memcpy(slot(next), accumulator.sum.data(), slot_floats * sizeof(float));
+        flush(data_offset + next * slot_floats * sizeof(float), slot_floats * sizeof(float));
+        h->samples[next] = accumulator.samples;
+        h->active = next;
+        flush(0, sizeof(checkpoint_header));
+    }
+
+    void remove() {
+        // Unmap and delete the file, once the render it protects is complete
+        close();
+        std::remove(path.c_str());
+    }
+
+    void close() {
+        // Unmap the file (what was saved stays in it)
+        if (!data)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+        CloseHandle(mapping);
+        CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        munmap(data, size);
+        ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+    }
+
+  private:
+    std::string path;
+    size_t slot_floats = 0;
+    // Floats in one slot
+    size_t size = 0;
+    // Size of the whole file
+    unsigned char* data = nullptr;
+    // Start of the mapping
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+
+    checkpoint_header* header() const { return reinterpret_cast<checkpoint_header*>(data); }
+    float* slot(uint32_t index) const {
+        return reinterpret_cast<float*>(data + data_offset) + index * slot_floats;
+    }
+
+    bool map(const std::string& file_path, size_t file_size) {
+        // Map file_size bytes of the file, growing or creating it. Returns true if the file
+        // already had that size (it may then hold a checkpoint).
+        bool existing = false;
+#ifdef _WIN32
+        file = CreateFileA(file_path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER current;
+        existing = GetFileSizeEx(file, &current) && static_cast<size_t>(current.QuadPart) == file_size;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(uint64_t(file_size) >> 32),
+                                     static_cast<DWORD>(file_size & 0xffffffffu), nullptr);
+        if (mapping)
+            data = static_cast<unsigned char*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, file_size));
+        if (!data) {
+            if (mapping)
+                CloseHandle(mapping);
+            CloseHandle(file);
+            mapping = nullptr;
+            file = INVALID_HANDLE_VALUE;
+        }
+#else
+        fd = ::open(file_path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        existing = fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) == file_size;
+        if (!existing && ftruncate(fd, static_cast<off_t>(file_size)) != 0) {
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        void* address = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) {
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        data = static_cast<unsigned char*>(address);
+#endif
+        return existing;
+    }
+
+    void flush(size_t offset, size_t length) const {
+        // Push a range of the mapping to disk before going on
+#ifdef _WIN32
+        FlushViewOfFile(data + offset, length);
+        FlushFileBuffers(file);
+#else
+        long page = sysconf(_SC_PAGESIZE);
+        size_t start = offset - offset % static_cast<size_t>(page);
+        msync(data + start, length + (offset - start), MS_SYNC);
+#endif
+    }
+};
+
+#endif
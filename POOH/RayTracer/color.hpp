@@ -16,8 +16,14 @@ inline double linear_to_gamma(double linear_component)
     // Return the square root of the linear component
 }
 
+inline double linear_to_gamma(double linear_component, double gamma)
+// Function to convert linear color to color encoded for the given display gamma
+{
+    return (gamma == 2.0) ? sqrt(linear_component) : pow(linear_component, 1.0 / gamma);
+}
+
 // Function to write the color components to the output stream
-void write_color(std::ostream &out, color pixel_color, int samples_per_pixel) {
+inline void write_color(std::ostream &out, color pixel_color, int samples_per_pixel) {
     // Write the translated [0,255] value of each color component
     auto r = pixel_color.x();
     // Red component
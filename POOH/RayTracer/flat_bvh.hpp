@@ -0,0 +1,917 @@
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include "ray_tracing_common.hpp"
+// Include the ray_tracing_common header file for common ray tracing utilities
+
+#include "hittable.hpp"
+// Include the hittable header file for hittable object representation
+#include "hittable_list.hpp"
+// Include the hittable list header file
+#include "scene_geometry.hpp"
+// Include the scene geometry header file, the primitives the leaves point to
+#include "ray_packet.hpp"
+// Include the ray packet header file for the SIMD packet traversal
+#include "render_stats.hpp"
+// Include the render stats header file for the hot path counters
+#include "table.hpp"
+// Include the table header file for the node and primitive arrays
+
+#include <algorithm>
+// Include the algorithm header file for STL algorithms
+#include <cstdint>
+// Include the cstdint header file for the fixed width node fields
+#include <cstring>
+// Include the cstring header file to compare refitted boxes
+#include <omp.h>
+// Include the OpenMP header file to refit the leaves in parallel
+#include <vector>
+// Include the vector header file for the build data
+
+struct flat_bvh_node {
+    // One node of the flattened hierarchy, 32 bytes so two nodes share a cache line.
+    float bmin[3];
+    // Lower corner of the node bounding box (rounded down)
+    float bmax[3];
+    // Upper corner of the node bounding box (rounded up)
+    uint32_t left_first;
+    // Interior node: index of the left child (the right child follows it)
+    // Leaf node: index of the first primitive in prim_indices
+    uint32_t count;
+    // Number of primitives of a leaf, 0 for an interior node
+
+    bool is_leaf() const { return count > 0; }
+};
+
+static_assert(sizeof(flat_bvh_node) == 32, "flat_bvh_node must stay 32 bytes");
+
+class flat_bvh : public hittable {
+    // Bounding Volume Hierarchy built with a binned Surface Area Heuristic and stored
+    // as a contiguous array of nodes. Traversal is iterative with a small explicit
+    // stack and visits the nearest child first, so far subtrees are often culled
+    // by the closest hit found in the near one.
+  public:
+    flat_bvh(const hittable_list& list) : flat_bvh(list.objects) {}
+
+    flat_bvh(const std::vector<shared_ptr<hittable>>& src_objects) {
+        // Hierarchy over arbitrary hittables, kept as custom objects of a scene_geometry
+        auto wrapped = make_shared<scene_geometry>();
+        for (const auto& object : src_objects)
+            wrapped->add_object(object);
+        geometry = wrapped;
+        build();
+    }
+
+    flat_bvh(shared_ptr<const scene_geometry> scene) : geometry(scene) {
+        // Hierarchy over the typed primitive tables of a scene
+        build();
+    }
+
+    flat_bvh(shared_ptr<const scene_geometry> scene, const table<flat_bvh_node>& prebuilt_nodes,
+             const table<uint32_t>& order, shared_ptr<const void> owner = nullptr)
+      : geometry(scene), prim_indices(order), nodes(prebuilt_nodes), bbox(scene->bounding_box()), storage(owner) {
+        // Hierarchy built earlier over the same scene (node_array and primitive_order of that
+        // one, e.g. read back from a file), used as it is. When the tables are attached to
+        // memory held by 'owner', the hierarchy keeps it alive. Check the tables with
+        // valid_layout first.
+    }
+
+    static uint64_t build_signature() {
+        // Settings of the builder, a hierarchy saved by a build with other settings is not reused
+        return (uint64_t(bin_count) << 32) | (uint64_t(max_leaf_size) << 16) | uint64_t(max_sah_depth);
+    }
+
+    static bool valid_layout(const table<flat_bvh_node>& nodes, const table<uint32_t>& order, size_t primitive_count) {
+        // True if the tables make a tree traversal can walk safely: every index in range,
+        // children after their parent and reached from a single one (no cycle, no shared
+        // subtree) and no leaf deeper than max_depth, so the traversal stacks cannot overflow
+        if (order.size() != primitive_count)
+            return false;
+        for (uint32_t p : order)
+            if (p >= primitive_count)
+                return false;
+        if (nodes.empty())
+            return true;
+
+        struct entry { uint32_t node; int depth; };
+        std::vector<entry> pending = {{0, 0}};
+        std::vector<bool> reached(nodes.size(), false);
+        reached[0] = true;
+        while (!pending.empty()) {
+            entry e = pending.back();
+            pending.pop_back();
+            const flat_bvh_node& n = nodes[e.node];
+            if (n.is_leaf()) {
+                if (uint64_t(n.left_first) + n.count > order.size())
+                    return false;
+                continue;
+            }
+            if (n.left_first <= e.node || uint64_t(n.left_first) + 1 >= nodes.size() || e.depth + 1 > max_depth)
+                return false;
+            for (uint32_t child = n.left_first; child < n.left_first + 2; child++) {
+                if (reached[child])
+                    return false;
+                reached[child] = true;
+                pending.push_back({child, e.depth + 1});
+            }
+        }
+        return true;
+    }
+
+    static const int max_depth = 128;
+    // Deepest leaf a hierarchy may have: a traversal defers at most one node per level
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        // Function to check if a ray hits the bounding volume hierarchy
+        if (nodes.empty())
+            return false;
+
+        const point3 orig = r.origin();
+        const vec3 dir = r.direction();
+        const double inv_dir[3] = { 1.0 / dir[0], 1.0 / dir[1], 1.0 / dir[2] };
+        // Inverse direction, computed once per ray instead of once per box
+
+        double t_root;
+        if (!slab_hit(nodes[0], orig, inv_dir, ray_t, t_root))
+            return false;
+
+        struct stack_entry { uint32_t node; double t_entry; };
+        stack_entry stack[max_stack];
+        // Deferred far children together with their entry distance
+        int sp = 0;
+
+        bool hit_anything = false;
+        uint32_t closest_prim = 0;
+        // Closest primitive so far, its hit record is only filled once the traversal is over
+        uint32_t current = 0;
+
+        while (true) {
+            const flat_bvh_node& node = nodes[current];
+            RT_STAT(bvh_nodes_visited);
+
+            if (node.is_leaf()) {
+                for (uint32_t k = 0; k < node.count; ++k) {
+                    double t;
+                    uint32_t prim = prim_indices[node.left_first + k];
+                    if (geometry->intersect_primitive(prim, r, ray_t, t, rec)) {
+                        hit_anything = true;
+                        closest_prim = prim;
+                        ray_t.max = t;
+                        // Shrink the ray so the remaining boxes can be culled
+                    }
+                }
+            } else {
+                uint32_t near_child = node.left_first;
+                uint32_t far_child = node.left_first + 1;
+                double t_near, t_far;
+                bool hit_near = slab_hit(nodes[near_child], orig, inv_dir, ray_t, t_near);
+                bool hit_far = slab_hit(nodes[far_child], orig, inv_dir, ray_t, t_far);
+
+                if (hit_near && hit_far) {
+                    if (t_far < t_near) {
+                        std::swap(near_child, far_child);
+                        std::swap(t_near, t_far);
+                    }
+                    stack[sp++] = { far_child, t_far };
+                    current = near_child;
+                    continue;
+                }
+                if (hit_near) { current = near_child; continue; }
+                if (hit_far) { current = far_child; continue; }
+            }
+
+            // Pop the next deferred node that can still contain a closer hit
+            bool found = false;
+            while (sp > 0) {
+                const stack_entry& e = stack[--sp];
+                if (e.t_entry <= ray_t.max) {
+                    current = e.node;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found)
+                break;
+        }
+
+        if (hit_anything)
+            geometry->finalize_hit(closest_prim, r, ray_t.max, rec);
+        return hit_anything;
+    }
+
+    void hit_packet(const ray* rays, int count, interval ray_t, hit_record* recs, bool* hits) const override {
+        // Trace up to ray_packet::max_size coherent rays together: every node is tested
+        // against all the rays at once with the SIMD slab kernel, and only the rays
+        // that reach a leaf are intersected with its primitives.
+        if (count > ray_packet::max_size) {
+            hittable::hit_packet(rays, count, ray_t, recs, hits);
+            return;
+        }
+        for (int k = 0; k < count; k++)
+            hits[k] = false;
+        if (nodes.empty() || count <= 0)
+            return;
+
+        static const packet_box_kernel box_mask = select_packet_box_kernel();
+        ray_packet packet;
+        packet.load(rays, count, ray_t);
+        double closest[ray_packet::max_size];
+        // Closest hit of every ray so far, in double precision for the primitive tests
+        uint32_t closest_prim[ray_packet::max_size];
+        // Closest primitive of every ray, hit records are filled once the traversal is over
+        for (int k = 0; k < count; k++)
+            closest[k] = ray_t.max;
+
+        const vec3 lead_dir = rays[0].direction();
+        // Direction used to order the children (the rays of a packet are coherent)
+
+        uint32_t stack[max_stack];
+        int sp = 0;
+        uint32_t current = 0;
+
+        while (true) {
+            const flat_bvh_node& node = nodes[current];
+            int mask = box_mask(packet, node.bmin, node.bmax);
+            RT_STAT(bvh_nodes_visited);
+
+            if (mask != 0) {
+                if (node.is_leaf()) {
+                    for (int k = 0; k < count; k++) {
+                        if (!(mask & (1 << k)))
+                            continue;
+                        for (uint32_t p = 0; p < node.count; ++p) {
+                            double t;
+                            uint32_t prim = prim_indices[node.left_first + p];
+                            if (geometry->intersect_primitive(prim, rays[k], interval(ray_t.min, closest[k]), t, recs[k])) {
+                                hits[k] = true;
+                                closest[k] = t;
+                                closest_prim[k] = prim;
+                                packet.shrink(k, t);
+                            }
+                        }
+                    }
+                } else {
+                    uint32_t near_child = node.left_first;
+                    uint32_t far_child = node.left_first + 1;
+                    if (center_along(nodes[far_child], lead_dir) < center_along(nodes[near_child], lead_dir))
+                        std::swap(near_child, far_child);
+                    stack[sp++] = far_child;
+                    current = near_child;
+                    continue;
+                }
+            }
+
+            if (sp == 0)
+                break;
+            current = stack[--sp];
+        }
+
+        for (int k = 0; k < count; k++)
+            if (hits[k])
+                geometry->finalize_hit(closest_prim[k], rays[k], closest[k], recs[k]);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+    // Function to compute the bounding box of the bounding volume hierarchy
+
+    size_t node_count() const { return nodes.size(); }
+    // Number of nodes in the hierarchy
+
+    const table<flat_bvh_node>& node_array() const { return nodes; }
+    // Flattened nodes, the root is the first one
+    const table<uint32_t>& primitive_order() const { return prim_indices; }
+    // Primitive indices referenced by the leaves
+    const shared_ptr<const scene_geometry>& primitive_source() const { return geometry; }
+    // Geometry the primitive indices refer to
+
+    double sah_cost() const {
+        // Expected cost of a ray through the hierarchy by the surface area heuristic, relative
+        // to the root box and counted in primitive tests (a traversal step counts as one, as
+        // for the build)
+        if (nodes.empty())
+            return 0;
+        double root_area = surface_area(node_box(0));
+        if (root_area <= 0)
+            return 0;
+        double cost = 0;
+        std::vector<uint32_t> pending = {0};
+        while (!pending.empty()) {
+            const flat_bvh_node& node = nodes[pending.back()];
+            pending.pop_back();
+            double area = surface_area(node_box(node));
+            if (node.is_leaf()) {
+                cost += area * node.count;
+            } else {
+                cost += area;
+                pending.push_back(node.left_first);
+                pending.push_back(node.left_first + 1);
+            }
+        }
+        return cost / root_area;
+    }
+
+    double build_cost() const { return built_cost; }
+    // sah_cost right after the last full build (or, for a prebuilt hierarchy, before its
+    // first refit or update), -1 until then
+
+    void refit(int threads = 0) {
+        // Recompute every box after any number of primitives changed in place, e.g. one frame
+        // of an animation. The tree keeps its shape, so it only stays good while primitives
+        // stay near the ones they share nodes with: compare sah_cost with build_cost to tell
+        // when a rebuild pays off. The leaves are refitted in parallel (threads 0 uses every
+        // hardware thread), then the interior nodes from the deepest up.
+        if (nodes.empty())
+            return;
+        if (built_cost < 0)
+            built_cost = sah_cost();
+        if (refit_order.empty())
+            refit_order = reachable_nodes();
+        if (threads <= 0)
+            threads = omp_get_max_threads();
+
+        // The boxes of the primitives are read in the order of the geometry, where they are
+        // contiguous, then gathered by the leaves from this one array
+        const int primitives = static_cast<int>(geometry->primitive_count());
+        std::vector<flat_bvh_node> boxes(primitives);
+        #pragma omp parallel for schedule(static) num_threads(threads)
+        for (int p = 0; p < primitives; p++)
+            store_bounds(boxes[p], geometry->primitive_bounds(static_cast<uint32_t>(p)));
+
+        const int count = static_cast<int>(refit_order.size());
+        #pragma omp parallel for schedule(static) num_threads(threads)
+        for (int k = 0; k < count; k++) {
+            flat_bvh_node& node = nodes[refit_order[k]];
+            if (!node.is_leaf())
+                continue;
+            const flat_bvh_node& first = boxes[prim_indices[node.left_first]];
+            std::memcpy(node.bmin, first.bmin, sizeof node.bmin);
+            std::memcpy(node.bmax, first.bmax, sizeof node.bmax);
+            for (uint32_t j = 1; j < node.count; j++) {
+                const flat_bvh_node& box = boxes[prim_indices[node.left_first + j]];
+                for (int a = 0; a < 3; a++) {
+                    node.bmin[a] = std::min(node.bmin[a], box.bmin[a]);
+                    node.bmax[a] = std::max(node.bmax[a], box.bmax[a]);
+                }
+            }
+        }
+        for (int k = count - 1; k >= 0; k--) {
+            flat_bvh_node& node = nodes[refit_order[k]];
+            if (!node.is_leaf())
+                enclose_children(node);
+        }
+        bbox = node_box(0);
+    }
+
+    // Updates after an edit of the geometry, each one touches a single leaf and the path
+    // from it to the root. The first update builds the parent of every node and the leaf of
+    // every primitive. Replaced leaf ranges and nodes stay in the arrays as garbage until
+    // rebuild; worn_out tells when that, or the depth reached by insertions, calls for it.
+
+    void update_primitive(uint32_t prim) {
+        // A primitive changed in place: refit its leaf if it still fits in it, else move it
+        // to the leaf where it adds the least area
+        prepare_updates();
+        aabb box = geometry->primitive_bounds(prim);
+        const flat_bvh_node& node = nodes[leaf_of[prim]];
+        bool inside = true;
+        for (int a = 0; a < 3; a++)
+            inside = inside && box.axis(a).min >= node.bmin[a] && box.axis(a).max <= node.bmax[a];
+        if (inside) {
+            refit_from(leaf_of[prim]);
+            return;
+        }
+        remove_primitive(prim);
+        insert_primitive(prim);
+    }
+
+    void insert_primitive(uint32_t prim) {
+        // Add a primitive of the geometry the hierarchy does not reference yet
+        prepare_updates();
+        refit_order.clear();
+        if (leaf_of.size() <= prim)
+            leaf_of.resize(prim + 1, no_node);
+        if (nodes.empty()) {
+            flat_bvh_node root;
+            store_bounds(root, geometry->primitive_bounds(prim));
+            root.left_first = static_cast<uint32_t>(prim_indices.size());
+            root.count = 1;
+            prim_indices.push_back(prim);
+            nodes.push_back(root);
+            parent.assign(1, no_node);
+            leaf_of[prim] = 0;
+            bbox = node_box(0);
+            return;
+        }
+
+        // Walk down to the leaf whose box grows the least
+        aabb box = geometry->primitive_bounds(prim);
+        uint32_t current = 0;
+        int depth = 0;
+        while (!nodes[current].is_leaf()) {
+            uint32_t left = nodes[current].left_first;
+            double grow_left = surface_area(aabb(node_box(left), box)) - surface_area(node_box(left));
+            double grow_right = surface_area(aabb(node_box(left + 1), box)) - surface_area(node_box(left + 1));
+            current = (grow_right < grow_left) ? left + 1 : left;
+            depth++;
+        }
+
+        // The leaf gets a new range at the end of prim_indices, with the primitive added
+        flat_bvh_node& leaf = nodes[current];
+        uint32_t first = static_cast<uint32_t>(prim_indices.size());
+        for (uint32_t k = 0; k < leaf.count; k++) {
+            uint32_t p = prim_indices[leaf.left_first + k];
+            prim_indices.push_back(p);
+        }
+        prim_indices.push_back(prim);
+        garbage_indices += leaf.count;
+        leaf.left_first = first;
+        leaf.count++;
+        leaf_of[prim] = current;
+        deepest = std::max(deepest, depth);
+
+        if (nodes[current].count > max_leaf_size)
+            rebuild_subtree(current, depth);
+        else
+            refit_from(current);
+    }
+
+    void remove_primitive(uint32_t prim) {
+        // Stop referencing a primitive (call before the geometry removes it)
+        prepare_updates();
+        refit_order.clear();
+        uint32_t current = leaf_of[prim];
+        flat_bvh_node& leaf = nodes[current];
+        uint32_t last = leaf.left_first + leaf.count - 1;
+        for (uint32_t k = leaf.left_first; k < last; k++)
+            if (prim_indices[k] == prim)
+                std::swap(prim_indices[k], prim_indices[last]);
+        leaf.count--;
+        garbage_indices++;
+        leaf_of[prim] = no_node;
+        if (leaf.count > 0) {
+            refit_from(current);
+            return;
+        }
+
+        // An empty leaf: its sibling takes the place of their parent
+        if (current == 0) {
+            nodes.clear();
+            parent.clear();
+            bbox = aabb();
+            return;
+        }
+        uint32_t up = parent[current];
+        uint32_t sibling = (current == nodes[up].left_first) ? current + 1 : current - 1;
+        nodes[up] = nodes[sibling];
+        if (nodes[up].is_leaf()) {
+            for (uint32_t k = 0; k < nodes[up].count; k++)
+                leaf_of[prim_indices[nodes[up].left_first + k]] = up;
+        } else {
+            parent[nodes[up].left_first] = up;
+            parent[nodes[up].left_first + 1] = up;
+        }
+        garbage_nodes += 2;
+        if (up == 0)
+            bbox = node_box(0);
+        else
+            refit_from(parent[up]);
+    }
+
+    void rename_primitive(uint32_t from, uint32_t to) {
+        // The geometry gave primitive 'from' the index 'to' (see scene_geometry::remove_primitive)
+        prepare_updates();
+        if (from != to) {
+            uint32_t current = leaf_of[from];
+            const flat_bvh_node& leaf = nodes[current];
+            for (uint32_t k = 0; k < leaf.count; k++)
+                if (prim_indices[leaf.left_first + k] == from)
+                    prim_indices[leaf.left_first + k] = to;
+            leaf_of[to] = current;
+        }
+        leaf_of.resize(geometry->primitive_count());
+    }
+
+    bool worn_out() const {
+        // True once garbage fills half of an array or insertions made the tree too deep
+        return 2 * garbage_nodes > nodes.size() || 2 * garbage_indices > prim_indices.size() ||
+               deepest > max_stack - 32;
+    }
+
+    void rebuild() {
+        // Build the whole hierarchy again over the current primitives, without garbage
+        storage.reset();
+        build();
+    }
+
+    shared_ptr<flat_bvh> copy(shared_ptr<const scene_geometry> scene) const {
+        // Copy over 'scene', a copy of the geometry of this one, that can be updated while
+        // this hierarchy is still in use: attached tables are copied into memory of its own
+        auto other = make_shared<flat_bvh>(*this);
+        other->geometry = scene;
+        other->nodes.own();
+        other->prim_indices.own();
+        other->storage.reset();
+        return other;
+    }
+
+  private:
+    static const int bin_count = 16;
+    // Number of bins used to evaluate the SAH along each axis
+    static const uint32_t max_leaf_size = 4;
+    // Below this many primitives a node always becomes a leaf
+    static const int max_sah_depth = 64;
+    // Deeper than this, nodes are split at the median so the tree depth stays bounded
+    static const int max_stack = max_depth;
+    // Size of the traversal stack (deeper than any tree the builder can produce)
+
+    shared_ptr<const scene_geometry> geometry;
+    // Primitives of the hierarchy
+    table<uint32_t> prim_indices;
+    // Primitive indices, reordered so every leaf references a contiguous range
+    table<flat_bvh_node> nodes;
+    // Flattened nodes, the root is nodes[0]
+    aabb bbox;
+    // Axis-aligned bounding box of the whole hierarchy
+    shared_ptr<const void> storage;
+    // Memory the node and primitive tables are attached to, if any
+
+    static constexpr uint32_t no_node = 0xffffffff;
+    std::vector<uint32_t> parent;
+    // Parent of every node (no_node for the root), only kept once the hierarchy is updated
+    std::vector<uint32_t> leaf_of;
+    // Leaf of every primitive, same
+    size_t garbage_nodes = 0;
+    size_t garbage_indices = 0;
+    // Entries of the arrays no longer reachable from the root
+    int deepest = 0;
+    // Depth of the deepest leaf, tracked once the hierarchy is updated
+    bool linked = false;
+    // True once parent and leaf_of are filled
+    double built_cost = -1;
+    // sah_cost of the hierarchy as it was built
+    std::vector<uint32_t> refit_order;
+    // Nodes reachable from the root, parents first, kept between refits until the shape changes
+
+    struct build_info {
+        // Per-primitive data only needed while building
+        aabb box;
+        point3 centroid;
+        uint32_t prim;
+    };
+
+    static bool slab_hit(const flat_bvh_node& node, const point3& orig, const double* inv_dir,
+                         const interval& ray_t, double& t_entry) {
+        // Slab test of the ray against the box of a node, returns the entry distance
+        double t_min = ray_t.min, t_max = ray_t.max;
+        for (int a = 0; a < 3; a++) {
+            double t0 = (node.bmin[a] - orig[a]) * inv_dir[a];
+            double t1 = (node.bmax[a] - orig[a]) * inv_dir[a];
+            if (inv_dir[a] < 0)
+                std::swap(t0, t1);
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_max < t_min)
+                return false;
+        }
+        t_entry = t_min;
+        return true;
+    }
+
+    static double center_along(const flat_bvh_node& node, const vec3& dir) {
+        // Position of the node center projected on a direction
+        return (node.bmin[0] + node.bmax[0]) * dir.x()
+             + (node.bmin[1] + node.bmax[1]) * dir.y()
+             + (node.bmin[2] + node.bmax[2]) * dir.z();
+    }
+
+    static double surface_area(const aabb& box) {
+        // Surface area of a box, 0 for an empty box
+        double dx = box.x.size(), dy = box.y.size(), dz = box.z.size();
+        if (dx < 0 || dy < 0 || dz < 0)
+            return 0;
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    static float round_down(double d) {
+        float f = static_cast<float>(d);
+        return (f > d) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+
+    static float round_up(double d) {
+        float f = static_cast<float>(d);
+        return (f < d) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+
+    static void store_bounds(flat_bvh_node& node, const aabb& box) {
+        // Store the box conservatively in single precision
+        for (int a = 0; a < 3; a++) {
+            node.bmin[a] = round_down(box.axis(a).min);
+            node.bmax[a] = round_up(box.axis(a).max);
+        }
+    }
+
+    static aabb node_box(const flat_bvh_node& node) {
+        return aabb(point3(node.bmin[0], node.bmin[1], node.bmin[2]), point3(node.bmax[0], node.bmax[1], node.bmax[2]));
+    }
+
+    aabb node_box(uint32_t index) const { return node_box(nodes[index]); }
+
+    void prepare_updates() {
+        // Parent of every node and leaf of every primitive, found once before the first update
+        if (linked)
+            return;
+        linked = true;
+        if (built_cost < 0)
+            built_cost = sah_cost();
+        parent.assign(nodes.size(), no_node);
+        leaf_of.assign(geometry->primitive_count(), no_node);
+        if (!nodes.empty())
+            link_subtree(0, 0);
+    }
+
+    void link_subtree(uint32_t top, int depth) {
+        // Set the parents and leaves below a node, and note how deep its leaves are
+        struct entry { uint32_t node; int depth; };
+        std::vector<entry> pending = {{top, depth}};
+        while (!pending.empty()) {
+            entry e = pending.back();
+            pending.pop_back();
+            const flat_bvh_node& node = nodes[e.node];
+            if (node.is_leaf()) {
+                for (uint32_t k = 0; k < node.count; k++)
+                    leaf_of[prim_indices[node.left_first + k]] = e.node;
+                deepest = std::max(deepest, e.depth);
+                continue;
+            }
+            for (uint32_t child = node.left_first; child < node.left_first + 2; child++) {
+                parent[child] = e.node;
+                pending.push_back({child, e.depth + 1});
+            }
+        }
+    }
+
+    aabb leaf_bounds(const flat_bvh_node& leaf) const {
+        // Box of the primitives of a leaf as they are now
+        aabb box;
+        for (uint32_t k = 0; k < leaf.count; k++)
+            box = aabb(box, geometry->primitive_bounds(prim_indices[leaf.left_first + k]));
+        return box;
+    }
+
+    void enclose_children(flat_bvh_node& node) const {
+        // Set the box of an interior node to the union of its children's
+        const flat_bvh_node& left = nodes[node.left_first];
+        const flat_bvh_node& right = nodes[node.left_first + 1];
+        for (int a = 0; a < 3; a++) {
+            node.bmin[a] = std::min(left.bmin[a], right.bmin[a]);
+            node.bmax[a] = std::max(left.bmax[a], right.bmax[a]);
+        }
+    }
+
+    std::vector<uint32_t> reachable_nodes() const {
+        // Every node reachable from the root, each one before its children (garbage left out)
+        std::vector<uint32_t> order;
+        order.reserve(nodes.size());
+        std::vector<uint32_t> pending = {0};
+        while (!pending.empty()) {
+            uint32_t current = pending.back();
+            pending.pop_back();
+            order.push_back(current);
+            if (!nodes[current].is_leaf()) {
+                pending.push_back(nodes[current].left_first + 1);
+                pending.push_back(nodes[current].left_first);
+            }
+        }
+        return order;
+    }
+
+    void refit_from(uint32_t current) {
+        // Recompute the boxes from a node up to the root, stopping at the first one that stays the same
+        while (current != no_node) {
+            flat_bvh_node& node = nodes[current];
+            flat_bvh_node before = node;
+            if (node.is_leaf())
+                store_bounds(node, leaf_bounds(node));
+            else
+                enclose_children(node);
+            if (std::memcmp(before.bmin, node.bmin, sizeof node.bmin) == 0 &&
+                std::memcmp(before.bmax, node.bmax, sizeof node.bmax) == 0)
+                return;
+            if (current == 0)
+                bbox = node_box(0);
+            current = parent[current];
+        }
+    }
+
+    void rebuild_subtree(uint32_t top, int depth) {
+        // Build the subtree of a node again over the primitives below it, in new entries at
+        // the end of the arrays (the old ones become garbage)
+        std::vector<build_info> info;
+        std::vector<uint32_t> pending = {top};
+        while (!pending.empty()) {
+            const flat_bvh_node& node = nodes[pending.back()];
+            pending.pop_back();
+            if (node.is_leaf()) {
+                for (uint32_t k = 0; k < node.count; k++)
+                    info.push_back(primitive_info(prim_indices[node.left_first + k]));
+                garbage_indices += node.count;
+            } else {
+                pending.push_back(node.left_first);
+                pending.push_back(node.left_first + 1);
+                garbage_nodes += 2;
+            }
+        }
+
+        uint32_t first = static_cast<uint32_t>(prim_indices.size());
+        prim_indices.resize(first + info.size());
+        build_node(top, first, static_cast<uint32_t>(info.size()), depth, info, first);
+        parent.resize(nodes.size(), no_node);
+        link_subtree(top, depth);
+        if (top == 0)
+            bbox = node_box(0);
+        else
+            refit_from(parent[top]);
+    }
+
+    void build() {
+        // Build the hierarchy over all primitives
+        size_t n = geometry->primitive_count();
+        nodes.clear();
+        prim_indices.clear();
+        parent.clear();
+        leaf_of.clear();
+        linked = false;
+        garbage_nodes = garbage_indices = 0;
+        deepest = 0;
+        refit_order.clear();
+        bbox = aabb();
+        built_cost = 0;
+        if (n == 0)
+            return;
+
+        std::vector<build_info> info(n);
+        for (size_t i = 0; i < n; i++)
+            info[i] = primitive_info(static_cast<uint32_t>(i));
+
+        prim_indices.resize(n);
+        nodes.reserve(2 * n - 1);
+        nodes.push_back(flat_bvh_node());
+        build_node(0, 0, static_cast<uint32_t>(n), 0, info, 0);
+
+        for (const auto& b : info)
+            bbox = aabb(bbox, b.box);
+        built_cost = sah_cost();
+    }
+
+    build_info primitive_info(uint32_t prim) const {
+        build_info b;
+        b.box = geometry->primitive_bounds(prim);
+        b.centroid = point3(0.5 * (b.box.x.min + b.box.x.max), 0.5 * (b.box.y.min + b.box.y.max),
+                            0.5 * (b.box.z.min + b.box.z.max));
+        b.prim = prim;
+        return b;
+    }
+
+    void build_node(uint32_t node_index, uint32_t first, uint32_t count, int depth,
+                    std::vector<build_info>& info, uint32_t base) {
+        // Recursively build the subtree of nodes[node_index] over prim_indices[first, first+count),
+        // whose primitives are info[first - base, first - base + count): the builder reorders
+        // info and writes the primitive indices of each leaf once it is made
+        build_info* range = info.data() + (first - base);
+        aabb bounds, centroid_bounds;
+        for (uint32_t k = 0; k < count; k++) {
+            bounds = aabb(bounds, range[k].box);
+            centroid_bounds = aabb(centroid_bounds, aabb(range[k].centroid, range[k].centroid));
+        }
+        store_bounds(nodes[node_index], bounds);
+
+        auto make_leaf = [&]() {
+            nodes[node_index].left_first = first;
+            nodes[node_index].count = count;
+            for (uint32_t k = 0; k < count; k++)
+                prim_indices[first + k] = range[k].prim;
+        };
+
+        if (count <= max_leaf_size) {
+            make_leaf();
+            return;
+        }
+
+        // Choose the axis with the widest spread of centroids
+        int axis = 0;
+        for (int a = 1; a < 3; a++)
+            if (centroid_bounds.axis(a).size() > centroid_bounds.axis(axis).size())
+                axis = a;
+
+        double c_min = centroid_bounds.axis(axis).min;
+        double extent = centroid_bounds.axis(axis).size();
+        if (extent <= 0) {
+            // Every centroid is at the same place, nothing to split
+            make_leaf();
+            return;
+        }
+
+        uint32_t mid;
+        if (depth < max_sah_depth) {
+            int split_bin;
+            bool worth_splitting = find_sah_split(range, count, bounds, centroid_bounds, split_bin, axis);
+            if (!worth_splitting) {
+                make_leaf();
+                return;
+            }
+
+            c_min = centroid_bounds.axis(axis).min;
+            extent = centroid_bounds.axis(axis).size();
+            double scale = bin_count / extent;
+            auto middle = std::partition(range, range + count,
+                [&](const build_info& b) { return bin_of(b.centroid[axis], c_min, scale) <= split_bin; });
+            mid = first + static_cast<uint32_t>(middle - range);
+        } else {
+            // Median split: guarantees the remaining depth is logarithmic
+            mid = first + count / 2;
+            std::nth_element(range, range + count / 2, range + count,
+                [&](const build_info& a, const build_info& b) { return a.centroid[axis] < b.centroid[axis]; });
+        }
+
+        if (mid == first || mid == first + count)
+            mid = first + count / 2;
+
+        uint32_t left = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(flat_bvh_node());
+        nodes.push_back(flat_bvh_node());
+        nodes[node_index].left_first = left;
+        nodes[node_index].count = 0;
+
+        build_node(left, first, mid - first, depth + 1, info, base);
+        build_node(left + 1, mid, first + count - mid, depth + 1, info, base);
+    }
+
+    static int bin_of(double c, double c_min, double scale) {
+        int b = static_cast<int>((c - c_min) * scale);
+        return (b < 0) ? 0 : (b >= bin_count) ? bin_count - 1 : b;
+    }
+
+    static bool find_sah_split(const build_info* range, uint32_t count, const aabb& bounds,
+                               const aabb& centroid_bounds, int& best_bin, int& best_axis) {
+        // Evaluate the binned SAH on every axis. Returns false when no split beats a leaf.
+        double best_cost = infinity;
+        best_bin = -1;
+
+        for (int axis = 0; axis < 3; axis++) {
+            double c_min = centroid_bounds.axis(axis).min;
+            double extent = centroid_bounds.axis(axis).size();
+            if (extent <= 0)
+                continue;
+            double scale = bin_count / extent;
+
+            aabb bin_box[bin_count];
+            uint32_t bin_cnt[bin_count] = {};
+            for (uint32_t k = 0; k < count; k++) {
+                const build_info& b = range[k];
+                int idx = bin_of(b.centroid[axis], c_min, scale);
+                bin_cnt[idx]++;
+                bin_box[idx] = aabb(bin_box[idx], b.box);
+            }
+
+            // Sweep from the right to get the cost of every right part
+            double right_area[bin_count];
+            uint32_t right_cnt[bin_count];
+            aabb acc;
+            uint32_t acc_cnt = 0;
+            for (int i = bin_count - 1; i > 0; i--) {
+                acc = aabb(acc, bin_box[i]);
+                acc_cnt += bin_cnt[i];
+                right_area[i] = surface_area(acc);
+                right_cnt[i] = acc_cnt;
+            }
+
+            // Sweep from the left and combine
+            acc = aabb();
+            acc_cnt = 0;
+            for (int i = 0; i < bin_count - 1; i++) {
+                acc = aabb(acc, bin_box[i]);
+                acc_cnt += bin_cnt[i];
+                if (acc_cnt == 0 || right_cnt[i + 1] == 0)
+                    continue;
+                double cost = acc_cnt * surface_area(acc) + right_cnt[i + 1] * right_area[i + 1];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_bin = i;
+                    best_axis = axis;
+                }
+            }
+        }
+
+        if (best_bin < 0)
+            return false;
+
+        // Compare with the cost of intersecting every primitive of a leaf
+        // (one traversal step is counted as one primitive test)
+        double parent_area = surface_area(bounds);
+        double split_cost = 1.0 + (parent_area > 0 ? best_cost / parent_area : 0);
+        double leaf_cost = static_cast<double>(count);
+        return split_cost < leaf_cost || count > 4 * max_leaf_size;
+    }
+};
+
+#endif
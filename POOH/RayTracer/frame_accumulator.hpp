@@ -0,0 +1,52 @@
+#ifndef FRAME_ACCUMULATOR_H
+#define FRAME_ACCUMULATOR_H
+
+#include "ray_tracing_common.hpp"
+// Include the ray_tracing_common header file for common ray tracing utilities
+#include "color.hpp"
+// Include the color header file for color representation
+#include "framebuffer.hpp"
+// Include the framebuffer header file for the resolved image
+
+#include <vector>
+// Include the vector header file for the pixel sums
+
+struct frame_accumulator {
+    // Running sum of the samples of every pixel, in single precision RGB. Progressive
+    // renders add one pass of samples after another to it; keeping it between two renders
+    // resumes the accumulation where it stopped.
+    int width = 0;
+    int height = 0;
+    // Size of the image
+    int samples = 0;
+    // Samples per pixel accumulated so far (every pixel has the same count)
+    std::vector<float> sum;
+    // Sum of the samples, three floats per pixel, rows from top to bottom
+
+    bool matches(int image_width, int image_height) const {
+        // True if the accumulation can be continued for an image of this size
+        return width == image_width && height == image_height &&
+               sum.size() == static_cast<size_t>(image_width) * image_height * 3;
+    }
+
+    void reset(int image_width, int image_height) {
+        // Start an empty accumulation
+        width = image_width;
+        height = image_height;
+        samples = 0;
+        sum.assign(static_cast<size_t>(width) * height * 3, 0.0f);
+    }
+
+    void resolve(framebuffer& frame) const {
+        // Average of every pixel, as linear radiance
+        frame.resize(width, height);
+        float scale = (samples > 0) ? 1.0f / samples : 0.0f;
+        for (size_t p = 0; p < static_cast<size_t>(width) * height; ++p) {
+            for (int c = 0; c < 3; ++c)
+                frame.rgba[p * 4 + c] = sum[p * 3 + c] * scale;
+            frame.rgba[p * 4 + 3] = 1.0f;
+        }
+    }
+};
+
+#endif
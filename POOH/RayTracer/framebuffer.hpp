@@ -0,0 +1,80 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "color.hpp"
+// Include the color header file for color representation
+#include "clamp.hpp"
+// Include the clamp header file for clamping utility
+
+#include <cmath>
+// Include the cmath header file for the exposure and gamma curves
+#include <vector>
+// Include the vector header file for the pixel storage
+
+struct framebuffer {
+    // Linear radiance of every pixel as single precision RGBA, rows from top to bottom.
+    // Nothing is clamped or quantized here: tonemapping only happens when an 8 bit image
+    // is written, so the same frame can be tonemapped again without rendering it again.
+    int width = 0;
+    int height = 0;
+    // Size of the image
+    std::vector<float> rgba;
+    // Four floats per pixel, alpha is 1 (the background is part of the image)
+
+    void resize(int image_width, int image_height) {
+        // Make room for an image of this size
+        width = image_width;
+        height = image_height;
+        rgba.assign(static_cast<size_t>(width) * height * 4, 0.0f);
+    }
+
+    void set(int i, int j, const color& pixel_color) {
+        // Store the linear color of pixel i,j
+        size_t index = (static_cast<size_t>(j) * width + i) * 4;
+        rgba[index + 0] = static_cast<float>(pixel_color.x());
+        rgba[index + 1] = static_cast<float>(pixel_color.y());
+        rgba[index + 2] = static_cast<float>(pixel_color.z());
+        rgba[index + 3] = 1.0f;
+    }
+};
+
+enum class tone_operator {
+    clamp,
+    // Values above 1 are cut off (the look of the original renders)
+    reinhard,
+    // x / (1 + x), compresses the highlights and never saturates
+    aces
+    // Filmic curve fitted to the ACES reference transform, more contrast than reinhard
+};
+
+struct tone_mapping {
+    // How linear radiance becomes a display value
+    tone_operator op = tone_operator::clamp;
+    // Curve applied to the exposed radiance
+    double exposure = 0;
+    // Exposure compensation in stops, the radiance is scaled by 2^exposure
+    double gamma = 2.0;
+    // Display gamma (1 leaves the values linear)
+
+    double apply(double linear) const {
+        // Display value in [0,1] of a linear channel value
+        double x = linear * std::exp2(exposure);
+        if (op == tone_operator::reinhard)
+            x = x / (1.0 + x);
+        else if (op == tone_operator::aces)
+            x = (x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14);
+        x = clamp(x, 0.0, 1.0);
+        return (gamma == 1.0) ? x : linear_to_gamma(x, gamma);
+    }
+
+    void to_8bit(const framebuffer& frame, std::vector<unsigned char>& rgb) const {
+        // Tonemapped 8 bit RGB copy of the frame (alpha is dropped)
+        size_t pixels = static_cast<size_t>(frame.width) * frame.height;
+        rgb.resize(pixels * 3);
+        for (size_t p = 0; p < pixels; ++p)
+            for (int c = 0; c < 3; ++c)
+                rgb[p * 3 + c] = static_cast<unsigned char>(255.999 * apply(frame.rgba[p * 4 + c]));
+    }
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+// Include the cstddef header file for size_t
+#include <cstdint>
+// Include the cstdint header file for the 64 bit hash
+#include <string>
+// Include the string header file to hash strings
+#include <vector>
+// Include the vector header file to hash vectors
+
+struct fnv1a {
+    // 64 bit FNV-1a hash, fed piece by piece. Used to recognise a scene or a camera again
+    // (checkpoints, cached BVHs), not for security.
+    uint64_t value = 14695981039346656037ull;
+    // Offset basis
+
+    void add(const void* data, size_t size) {
+        // Hash raw bytes
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t k = 0; k < size; ++k) {
+            value ^= bytes[k];
+            value *= 1099511628211ull;
+            // FNV prime
+        }
+    }
+
+    template <typename T>
+    void add(const T& plain_value) {
+        // Hash a number or another plain value by its bytes
+        add(&plain_value, sizeof plain_value);
+    }
+
+    void add(const std::string& text) {
+        // Hash the length and the characters, so "ab","c" differs from "a","bc"
+        add(text.size());
+        add(text.data(), text.size());
+    }
+
+    template <typename T>
+    void add(const std::vector<T>& values) {
+        // Hash the length and every element
+        add(values.size());
+        for (const T& v : values)
+            add(v);
+    }
+};
+
+#endif
@@ -16,8 +16,10 @@ class hit_record {
     // Point of intersection
     vec3 normal;
     // Normal vector at the point of intersection
-    shared_ptr<material> mat;
-    // Shared pointer to the material of the object
+    const material* mat;
+    // Material of the object. Not owning: materials are owned by the objects or by the
+    // scene material table, which outlive every hit record, so copying a record never
+    // touches a reference count.
     double t;
     // Parameter value of the intersection point
     double u;
@@ -45,9 +47,17 @@ class hittable {
 
     virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
     // Pure virtual function to check if a ray hits the object
+    // (rec must only be written when a hit inside ray_t is returned)
 
     virtual aabb bounding_box() const = 0;
     // Pure virtual function to compute the bounding box of the object
+
+    virtual void hit_packet(const ray* rays, int count, interval ray_t, hit_record* recs, bool* hits) const {
+        // Intersect a small packet of rays. The default tests the rays one by one,
+        // acceleration structures override it with a SIMD traversal.
+        for (int k = 0; k < count; k++)
+            hits[k] = hit(rays[k], ray_t, recs[k]);
+    }
 };
 
 #endif
\ No newline at end of file
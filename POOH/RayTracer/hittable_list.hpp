@@ -6,6 +6,8 @@
 
 #include "aabb.hpp"
 // Include the aabb header file for axis-aligned bounding box representation
+#include "render_stats.hpp"
+// Include the render stats header file for the hot path counters
 
 #include <memory>
 // Include the memory header file for shared_ptr and make_shared
@@ -53,8 +55,8 @@ class hittable_list : public hittable {
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
         // Function to check if a ray hits any of the objects in the list
-        hit_record temp_rec;
-        // Temporary hit record
+        // An object only writes rec when it reports a hit closer than closest_so_far,
+        // so no temporary record has to be copied around.
         bool hit_anything = false;
         // Flag indicating if the ray hits any object
         auto closest_so_far = ray_t.max;
@@ -62,14 +64,13 @@ class hittable_list : public hittable {
 
         for (const auto& object : objects) {
             // Iterate over the list of hittable objects
-            if (object->hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+            RT_STAT(primitive_tests);
+            if (object->hit(r, interval(ray_t.min, closest_so_far), rec)) {
                 // Check if the ray hits the current object
                 hit_anything = true;
                 // Set the hit flag to true
-                closest_so_far = temp_rec.t;
+                closest_so_far = rec.t;
                 // Update the closest hit so far
-                rec = temp_rec;
-                // Set the hit record to the temporary hit record
             }
         }
 
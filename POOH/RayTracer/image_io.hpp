@@ -0,0 +1,208 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+// Define the STB_IMAGE_WRITE_IMPLEMENTATION macro
+#include "stb_image_write.h"
+// Include the stb_image_write header file for the PNG encoder
+#include "framebuffer.hpp"
+// Include the framebuffer header file for the linear image
+
+#include <cstdint>
+// Include the cstdint header file for the fixed width EXR fields
+#include <cstring>
+// Include the cstring header file to copy the float bits
+#include <fstream>
+// Include the fstream header file to write the HDR files
+#include <string>
+// Include the string header file for the file names
+#include <vector>
+// Include the vector header file for the pixel rows
+
+// Writers for a rendered frame, and a reader for the PFM files written here. PNG is
+// tonemapped to 8 bits for display; PFM and EXR keep the linear float radiance untouched
+// for compositing. Every function returns false if the file could not be written or read.
+
+namespace image_io {
+
+inline bool has_extension(const std::string& path, const std::string& extension) {
+    // Case insensitive check of the file extension (".exr", ".pfm", ...)
+    if (path.size() < extension.size())
+        return false;
+    for (size_t k = 0; k < extension.size(); ++k) {
+        char c = path[path.size() - extension.size() + k];
+        if (c >= 'A' && c <= 'Z')
+            c = static_cast<char>(c - 'A' + 'a');
+        if (c != extension[k])
+            return false;
+    }
+    return true;
+}
+
+inline void put_u32(std::vector<unsigned char>& out, uint32_t value) {
+    // Append a 32 bit value in little endian order
+    for (int k = 0; k < 4; ++k)
+        out.push_back(static_cast<unsigned char>(value >> (8 * k)));
+}
+
+inline void put_u64(std::vector<unsigned char>& out, uint64_t value) {
+    // Append a 64 bit value in little endian order
+    for (int k = 0; k < 8; ++k)
+        out.push_back(static_cast<unsigned char>(value >> (8 * k)));
+}
+
+inline void put_float(std::vector<unsigned char>& out, float value) {
+    // Append an IEEE single precision float in little endian order
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof bits);
+    put_u32(out, bits);
+}
+
+inline void put_string(std::vector<unsigned char>& out, const char* text) {
+    // Append a null terminated string
+    out.insert(out.end(), text, text + std::strlen(text) + 1);
+}
+
+inline bool save(const std::string& path, const std::vector<unsigned char>& bytes) {
+    // Write the bytes to a binary file
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    return static_cast<bool>(file);
+}
+
+inline bool write_png(const std::string& path, const framebuffer& frame, const tone_mapping& tone) {
+    // Tonemapped 8 bit RGB PNG
+    std::vector<unsigned char> rgb;
+    tone.to_8bit(frame, rgb);
+    return stbi_write_png(path.c_str(), frame.width, frame.height, 3, rgb.data(), frame.width * 3) != 0;
+}
+
+inline bool write_pfm(const std::string& path, const framebuffer& frame) {
+    // Portable float map: linear RGB floats, little endian (negative scale), rows from
+    // bottom to top as the format requires. Alpha is not stored.
+    std::string header = "PF\n" + std::to_string(frame.width) + " " + std::to_string(frame.height) + "\n-1.0\n";
+    std::vector<unsigned char> bytes(header.begin(), header.end());
+    bytes.reserve(bytes.size() + static_cast<size_t>(frame.width) * frame.height * 12);
+    for (int j = frame.height - 1; j >= 0; --j)
+        for (int i = 0; i < frame.width; ++i)
+            for (int c = 0; c < 3; ++c)
+                put_float(bytes, frame.rgba[(static_cast<size_t>(j) * frame.width + i) * 4 + c]);
+    return save(path, bytes);
+}
+
+inline bool read_pfm(const std::string& path, framebuffer& frame) {
+    // Read a color (PF) portable float map of either byte order into the frame
+    std::ifstream file(path, std::ios::binary);
+    std::string magic;
+    int width = 0, height = 0;
+    double scale = 0;
+    if (!(file >> magic >> width >> height >> scale) || magic != "PF" || width <= 0 || height <= 0 || scale == 0)
+        return false;
+    file.get();
+    // Single whitespace character before the pixels
+
+    std::vector<unsigned char> bytes(static_cast<size_t>(width) * height * 12);
+    if (!file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size())))
+        return false;
+
+    frame.resize(width, height);
+    bool little_endian = scale < 0;
+    size_t k = 0;
+    for (int j = height - 1; j >= 0; --j) {
+        for (int i = 0; i < width; ++i) {
+            size_t index = (static_cast<size_t>(j) * width + i) * 4;
+            for (int c = 0; c < 3; ++c, k += 4) {
+                uint32_t bits = 0;
+                for (int b = 0; b < 4; ++b)
+                    bits |= static_cast<uint32_t>(bytes[k + (little_endian ? b : 3 - b)]) << (8 * b);
+                std::memcpy(&frame.rgba[index + c], &bits, sizeof bits);
+            }
+            frame.rgba[index + 3] = 1.0f;
+        }
+    }
+    return true;
+}
+
+inline bool write_exr(const std::string& path, const framebuffer& frame) {
+    // Minimal OpenEXR: single part scanline image, no compression, 32 bit float RGBA.
+    // Readable by any OpenEXR based tool.
+    std::vector<unsigned char> bytes;
+    put_u32(bytes, 20000630);
+    // Magic number
+    put_u32(bytes, 2);
+    // Version 2, single part scanline file
+
+    auto attribute = [&](const char* name, const char* type, uint32_t size) {
+        put_string(bytes, name);
+        put_string(bytes, type);
+        put_u32(bytes, size);
+    };
+    const char* channels[] = {"A", "B", "G", "R"};
+    // Channels are stored in alphabetical order
+    attribute("channels", "chlist", 4 * 18 + 1);
+    for (const char* channel : channels) {
+        put_string(bytes, channel);
+        put_u32(bytes, 2);
+        // FLOAT pixels
+        put_u32(bytes, 0);
+        // pLinear and three reserved bytes
+        put_u32(bytes, 1);
+        put_u32(bytes, 1);
+        // No subsampling
+    }
+    bytes.push_back(0);
+    attribute("compression", "compression", 1);
+    bytes.push_back(0);
+    for (const char* window : {"dataWindow", "displayWindow"}) {
+        attribute(window, "box2i", 16);
+        put_u32(bytes, 0);
+        put_u32(bytes, 0);
+        put_u32(bytes, static_cast<uint32_t>(frame.width - 1));
+        put_u32(bytes, static_cast<uint32_t>(frame.height - 1));
+    }
+    attribute("lineOrder", "lineOrder", 1);
+    bytes.push_back(0);
+    // Increasing y
+    attribute("pixelAspectRatio", "float", 4);
+    put_float(bytes, 1.0f);
+    attribute("screenWindowCenter", "v2f", 8);
+    put_float(bytes, 0.0f);
+    put_float(bytes, 0.0f);
+    attribute("screenWindowWidth", "float", 4);
+    put_float(bytes, 1.0f);
+    bytes.push_back(0);
+    // End of the header
+
+    // Offset table: one chunk per scanline, each a y coordinate, a size and the rows of
+    // the four channels
+    uint32_t row_bytes = static_cast<uint32_t>(frame.width) * 4 * 4;
+    uint64_t first_chunk = bytes.size() + static_cast<uint64_t>(frame.height) * 8;
+    for (int j = 0; j < frame.height; ++j)
+        put_u64(bytes, first_chunk + static_cast<uint64_t>(j) * (8 + row_bytes));
+
+    const int channel_offset[] = {3, 2, 1, 0};
+    // Offset in an RGBA pixel of A, B, G and R
+    bytes.reserve(bytes.size() + static_cast<size_t>(frame.height) * (8 + row_bytes));
+    for (int j = 0; j < frame.height; ++j) {
+        put_u32(bytes, static_cast<uint32_t>(j));
+        put_u32(bytes, row_bytes);
+        for (int offset : channel_offset)
+            for (int i = 0; i < frame.width; ++i)
+                put_float(bytes, frame.rgba[(static_cast<size_t>(j) * frame.width + i) * 4 + offset]);
+    }
+    return save(path, bytes);
+}
+
+inline bool write_image(const std::string& path, const framebuffer& frame, const tone_mapping& tone) {
+    // Write the frame in the format given by the extension of path: .exr and .pfm keep the
+    // linear radiance, anything else is written as a tonemapped PNG
+    if (has_extension(path, ".exr"))
+        return write_exr(path, frame);
+    if (has_extension(path, ".pfm"))
+        return write_pfm(path, frame);
+    return write_png(path, frame, tone);
+}
+
+}
+
+#endif
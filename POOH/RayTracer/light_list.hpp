@@ -0,0 +1,177 @@
+#ifndef LIGHT_LIST_H
+#define LIGHT_LIST_H
+
+#include "ray_tracing_common.hpp"
+// Include the ray_tracing_common header file for common ray tracing utilities
+
+#include "material.hpp"
+// Include the material header file for the emitted light
+#include "sphere.hpp"
+// Include the sphere header file for the shared sphere intersection
+#include "quad.hpp"
+// Include the quad header file for the shared quad intersection
+
+#include <vector>
+// Include the vector header file for the light array
+
+struct light_sample {
+    // Point picked on a light, seen from a shading point
+    vec3 direction;
+    // From the shading point to the light point (not normalized, the light point is at t = 1)
+    double pdf;
+    // Solid angle density of the direction, light selection included
+    color emission;
+    // Light emitted at the light point
+};
+
+class light_list {
+    // Emitters of a scene (stationary spheres and quads with an emissive material), used
+    // to aim shadow rays at the lights instead of waiting for bounces to hit them.
+    // A light is picked uniformly, then a point on it: uniformly over the area of a quad,
+    // uniformly inside the cone a sphere subtends. Moving spheres are not sampled, they
+    // are only found by the bounces.
+  public:
+    void add_quad(const point3& Q, const vec3& u, const vec3& v, const material* mat) {
+        // Add an emissive parallelogram with corner Q and edges u and v
+        light l;
+        vec3 n = cross(u, v);
+        l.kind = quad_light;
+        l.position = Q;
+        l.u = u;
+        l.v = v;
+        l.normal = unit_vector(n);
+        l.w = n / dot(n, n);
+        l.d = dot(l.normal, Q);
+        l.area = n.length();
+        l.mat = mat;
+        lights.push_back(l);
+    }
+
+    void add_sphere(const point3& center, double radius, const material* mat) {
+        // Add an emissive sphere
+        light l;
+        l.kind = sphere_light;
+        l.position = center;
+        l.radius = radius;
+        l.mat = mat;
+        lights.push_back(l);
+    }
+
+    bool empty() const { return lights.empty(); }
+    // True when the scene has no light to sample
+    size_t size() const { return lights.size(); }
+    // Number of lights
+
+    bool sample(const point3& origin, double time, sampler& rng, light_sample& s) const {
+        // Pick a light and a point on it as seen from origin. Returns false when the
+        // chosen light can not be sampled from there (the sample then counts as black).
+        if (lights.empty())
+            return false;
+        size_t index = static_cast<size_t>(random_double(rng) * lights.size());
+        if (index >= lights.size())
+            index = lights.size() - 1;
+        const light& l = lights[index];
+        double select = 1.0 / lights.size();
+
+        if (l.kind == quad_light) {
+            double alpha = random_double(rng);
+            double beta = random_double(rng);
+            point3 p = l.position + alpha * l.u + beta * l.v;
+            s.direction = p - origin;
+            double distance_squared = s.direction.length_squared();
+            double cosine = fabs(dot(s.direction, l.normal)) / sqrt(distance_squared);
+            if (cosine < 1e-8)
+                return false;
+            s.pdf = select * distance_squared / (cosine * l.area);
+            s.emission = l.mat->emitted(alpha, beta, p);
+            return true;
+        }
+
+        vec3 to_center = l.position - origin;
+        double distance_squared = to_center.length_squared();
+        double radius_squared = l.radius * l.radius;
+        if (distance_squared <= radius_squared)
+            return false;
+        // No cone to sample from inside the sphere
+        double cos_theta_max = sqrt(1 - radius_squared / distance_squared);
+
+        // Direction uniformly inside the cone around to_center
+        double r1 = random_double(rng);
+        double r2 = random_double(rng);
+        double z = 1 + r2 * (cos_theta_max - 1);
+        double phi = 2 * pi * r1;
+        double sin_theta = sqrt(fmax(0.0, 1 - z * z));
+        vec3 axis = unit_vector(to_center);
+        vec3 helper = (fabs(axis.x()) > 0.9) ? vec3(0, 1, 0) : vec3(1, 0, 0);
+        vec3 tangent = unit_vector(cross(axis, helper));
+        vec3 bitangent = cross(axis, tangent);
+        vec3 direction = cos(phi) * sin_theta * tangent + sin(phi) * sin_theta * bitangent + z * axis;
+
+        double t;
+        if (!hit_sphere_distance(l.position, l.radius, ray(origin, direction, time), interval(0, infinity), t))
+            return false;
+        s.direction = t * direction;
+        s.pdf = select / (2 * pi * (1 - cos_theta_max));
+        double u, v;
+        get_sphere_uv((origin + s.direction - l.position) / l.radius, u, v);
+        s.emission = l.mat->emitted(u, v, origin + s.direction);
+        return true;
+    }
+
+    double pdf(const ray& r, double t_hit) const {
+        // Density with which sample() would have picked the direction of r, for the light
+        // the ray hits at distance t_hit (0 if that surface is not one of the lights)
+        if (lights.empty())
+            return 0;
+        double select = 1.0 / lights.size();
+        double tolerance = 1e-6 * (1 + t_hit);
+
+        for (const light& l : lights) {
+            double t;
+            if (l.kind == quad_light) {
+                double alpha, beta;
+                if (!hit_quad_plane(l.position, l.u, l.v, l.normal, l.d, l.w, r, interval(0, infinity), t, alpha, beta))
+                    continue;
+                if (alpha < 0 || alpha > 1 || beta < 0 || beta > 1 || fabs(t - t_hit) > tolerance)
+                    continue;
+                double distance_squared = t * t * r.direction().length_squared();
+                double cosine = fabs(dot(r.direction(), l.normal)) / r.direction().length();
+                return (cosine < 1e-8) ? 0 : select * distance_squared / (cosine * l.area);
+            }
+
+            if (!hit_sphere_distance(l.position, l.radius, r, interval(0, infinity), t) || fabs(t - t_hit) > tolerance)
+                continue;
+            double distance_squared = (l.position - r.origin()).length_squared();
+            double radius_squared = l.radius * l.radius;
+            if (distance_squared <= radius_squared)
+                return 0;
+            double cos_theta_max = sqrt(1 - radius_squared / distance_squared);
+            return select / (2 * pi * (1 - cos_theta_max));
+        }
+        return 0;
+    }
+
+  private:
+    enum light_kind { quad_light, sphere_light };
+
+    struct light {
+        light_kind kind;
+        point3 position;
+        // Corner of a quad, center of a sphere
+        vec3 u, v, normal, w;
+        // Quad edges, unit normal and cached n / (n.n)
+        double d = 0;
+        // Quad plane offset
+        double area = 0;
+        // Quad area
+        double radius = 0;
+        // Sphere radius
+        const material* mat;
+        // Emissive material, owned by the scene material table
+    };
+
+    std::vector<light> lights;
+    // Every light of the scene
+};
+
+#endif
@@ -9,6 +9,8 @@
 // Include the hittable header file for hittable object representation
 #include "texture.hpp"
 // Include the texture header file for texture representation
+#include "render_stats.hpp"
+// Include the render stats header file for the hot path counters
 
 class hit_record;
 
@@ -18,14 +20,25 @@ class material {
     // Virtual destructor to ensure proper cleanup of derived classes
 
     virtual bool scatter(
-        const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
-    // Pure virtual function to compute the scattered ray and attenuation
+        const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& rng) const = 0;
+    // Pure virtual function to compute the scattered ray and attenuation (random numbers come from rng)
 
     virtual color emitted(double u, double v, const point3& p) const {
       // Function to compute the emitted color
         return color(0,0,0);
         // Return black color
     }
+
+    virtual bool is_emissive() const { return false; }
+    // True for materials that emit light (the scene samples them as lights)
+
+    virtual double scattering_pdf(const ray& /*r_in*/, const hit_record& /*rec*/, const ray& /*scattered*/) const {
+      // Solid angle density with which scatter() picks 'scattered'. Materials that sample
+      // their BSDF times cosine exactly return it, so that attenuation * scattering_pdf is
+      // the BSDF times cosine for any direction and light sampling can be used on them.
+      // Specular materials return 0: no light sampling, bounces only.
+        return 0;
+    }
 };
 
 class lambertian : public material {
@@ -36,9 +49,10 @@ class lambertian : public material {
     lambertian(shared_ptr<texture> a) : albedo(a) {}
     // Constructor initializing the albedo of the material
 
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& rng) const override {
       // Function to compute the scattered ray and attenuation
-        auto scatter_direction = rec.normal + random_unit_vector();
+        RT_STAT(scatter_events);
+        auto scatter_direction = rec.normal + random_unit_vector(rng);
         // Compute the scattered ray direction
         if (scatter_direction.near_zero())
         // If the scattered ray direction is near zero
@@ -51,6 +65,12 @@ class lambertian : public material {
         return true;
     }
 
+    double scattering_pdf(const ray& /*r_in*/, const hit_record& rec, const ray& scattered) const override {
+      // Cosine distribution of the scattered directions
+        auto cos_theta = dot(rec.normal, unit_vector(scattered.direction()));
+        return cos_theta < 0 ? 0 : cos_theta / pi;
+    }
+
   private:
     shared_ptr<texture> albedo;
     // Texture of the material
@@ -62,12 +82,13 @@ class metal : public material {
     metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
     // Constructor initializing the albedo and fuzziness of the material
 
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& rng)
     // Function to compute the scattered ray and attenuation
     const override {
+        RT_STAT(scatter_events);
         vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);   
         // Compute the reflected ray
-        scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere(), r_in.time());
+        scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere(rng), r_in.time());
         // Set the scattered ray
         attenuation = albedo;
         // Set the attenuation
@@ -90,9 +111,10 @@ class dielectric : public material {
     dielectric(double index_of_refraction) : ir(index_of_refraction) {}
     // Constructor initializing the index of refraction of the material
 
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& rng)
     // Function to compute the scattered ray and attenuation
     const override {
+        RT_STAT(scatter_events);
         attenuation = color(1.0, 1.0, 1.0);
         // Set the attenuation
         double refraction_ratio = rec.front_face ? (1.0/ir) : ir;
@@ -110,7 +132,7 @@ class dielectric : public material {
         vec3 direction;
         // Create a direction vector for the scattered ray
 
-        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
+        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double(rng))
         // If the ray cannot be refracted or the reflectance is greater than a random value
             direction = reflect(unit_direction, rec.normal);
             // Compute the reflected ray
@@ -141,7 +163,7 @@ class diffuse_light : public material {
     diffuse_light(shared_ptr<texture> a) : emit(a) {}
     diffuse_light(color c) : emit(make_shared<solid_color>(c)) {}
 
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler&)
     const override {
         return false;
     }
@@ -150,6 +172,8 @@ class diffuse_light : public material {
         return emit->value(u, v, p);
     }
 
+    bool is_emissive() const override { return true; }
+
   private:
     shared_ptr<texture> emit;
 };
@@ -9,6 +9,35 @@
 
 #include <cmath>
 
+inline bool hit_quad_plane(const point3& Q, const vec3& u, const vec3& v, const vec3& normal, double D,
+                           const vec3& w, const ray& r, const interval& ray_t, double& t, double& alpha, double& beta) {
+    // Intersect the ray with the plane of a quad. On a hit inside ray_t, returns the
+    // distance t and the plane coordinates (alpha, beta) of the hit point along u and v.
+    // Shared by the quad class and the quad arrays of scene_geometry.
+    auto denom = dot(normal, r.direction());
+    // Compute the denominator of the ray-plane intersection formula.
+
+    // No hit if the ray is parallel to the plane.
+    if (fabs(denom) < 1e-8)
+        return false;
+
+    // Return false if the hit point parameter t is outside the ray interval.
+    t = (D - dot(normal, r.origin())) / denom;
+    if (!ray_t.contains(t))
+        return false;
+
+    // Plane coordinates of the hit point.
+    vec3 planar_hitpt_vector = r.at(t) - Q;
+    alpha = dot(w, cross(planar_hitpt_vector, v));
+    beta = dot(w, cross(u, planar_hitpt_vector));
+    return true;
+}
+
+inline aabb quad_bounds(const point3& Q, const vec3& u, const vec3& v) {
+    // Bounding box of the four corners of a quad, padded so it is never flat.
+    return aabb(aabb(Q, Q + u + v), aabb(Q + u, Q + v)).pad();
+}
+
 class quad : public hittable {
   public:
     quad(const point3& _Q, const vec3& _u, const vec3& _v, shared_ptr<material> m)
@@ -30,7 +59,7 @@ class quad : public hittable {
 
     virtual void set_bounding_box() {
         // Set the bounding box of the quad.
-        bbox = aabb(Q, Q + u + v).pad();
+        bbox = quad_bounds(Q, u, v);
     }
 
     aabb bounding_box() const override { return bbox; }
@@ -38,31 +67,10 @@ class quad : public hittable {
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
         // Check if the ray intersects the quad.
-        auto denom = dot(normal, r.direction());
-        // Compute the denominator of the ray-plane intersection formula.
-
-        // No hit if the ray is parallel to the plane.
-        if (fabs(denom) < 1e-8)
-        // Check if the ray is parallel to the plane
-            return false;
-
-        // Return false if the hit point parameter t is outside the ray interval.
-        auto t = (D - dot(normal, r.origin())) / denom;
-        // Compute the parameter value of the intersection point
-        if (!ray_t.contains(t))
-        // Check if the intersection point is within the ray interval
+        double t, alpha, beta;
+        if (!hit_quad_plane(Q, u, v, normal, D, w, r, ray_t, t, alpha, beta))
             return false;
 
-        // Determine the hit point lies within the planar shape using its plane coordinates.
-        auto intersection = r.at(t);
-        // Compute the intersection point
-        vec3 planar_hitpt_vector = intersection - Q;
-        // Compute the vector from the quad origin to the intersection point
-        auto alpha = dot(w, cross(planar_hitpt_vector, v));
-        // Compute the alpha coordinate of the intersection point
-        auto beta = dot(w, cross(u, planar_hitpt_vector));
-        // Compute the beta coordinate of the intersection point
-
         if (!is_interior(alpha, beta, rec))
         // Check if the intersection point is within the planar shape
             return false;
@@ -71,10 +79,10 @@ class quad : public hittable {
 
         rec.t = t;
         // Set the parameter value of the intersection point
-        rec.p = intersection;
+        rec.p = r.at(t);
         // Set the intersection point
-        rec.mat = mat;
-        // Set the material of the object
+        rec.mat = mat.get();
+        // Set the material of the object (owned by the quad, no reference count traffic)
         rec.set_face_normal(r, normal);
         // Set the normal vector of the intersection point
 
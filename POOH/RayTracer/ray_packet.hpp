@@ -0,0 +1,190 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "ray_tracing_common.hpp"
+// Include the ray_tracing_common header file for common ray tracing utilities
+
+#include <cstdint>
+// Include the cstdint header file for fixed width integers
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RT_X86_SIMD 1
+// SSE2 is part of x86-64, AVX2 still has to be checked at runtime
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define RT_X86_SIMD 0
+#endif
+
+#if RT_X86_SIMD && (defined(__GNUC__) || defined(__clang__))
+#define RT_TARGET_AVX2 __attribute__((target("avx2")))
+// Let GCC/Clang emit AVX2 for a single function without -mavx2 on the whole build
+#else
+#define RT_TARGET_AVX2
+#endif
+
+enum class simd_level {
+    scalar,
+    // Plain C++, one lane at a time
+    sse,
+    // 4 lanes per instruction
+    avx2
+    // 8 lanes per instruction
+};
+
+inline simd_level detect_simd_level() {
+    // Returns the widest instruction set the CPU (and OS) supports
+#if RT_X86_SIMD
+  #ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return simd_level::sse;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return simd_level::sse;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) ? simd_level::avx2 : simd_level::sse;
+  #else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? simd_level::avx2 : simd_level::sse;
+  #endif
+#else
+    return simd_level::scalar;
+#endif
+}
+
+struct ray_packet {
+    // Up to 8 rays in structure-of-arrays single precision layout, ready for the SIMD kernels.
+    static const int max_size = 8;
+
+    int size = 0;
+    // Number of valid lanes
+    alignas(32) float ox[max_size], oy[max_size], oz[max_size];
+    // Ray origins
+    alignas(32) float idx[max_size], idy[max_size], idz[max_size];
+    // Inverse ray directions
+    alignas(32) float tmin[max_size], tmax[max_size];
+    // Valid interval of every ray, tmax shrinks as closer hits are found
+
+    void load(const ray* rays, int count, interval ray_t) {
+        // Fill the packet from 'count' rays, unused lanes get an empty interval
+        size = count;
+        for (int k = 0; k < max_size; k++) {
+            if (k < count) {
+                point3 o = rays[k].origin();
+                vec3 d = rays[k].direction();
+                ox[k] = static_cast<float>(o.x());
+                oy[k] = static_cast<float>(o.y());
+                oz[k] = static_cast<float>(o.z());
+                idx[k] = static_cast<float>(1.0 / d.x());
+                idy[k] = static_cast<float>(1.0 / d.y());
+                idz[k] = static_cast<float>(1.0 / d.z());
+                tmin[k] = static_cast<float>(ray_t.min);
+                tmax[k] = static_cast<float>(ray_t.max);
+            } else {
+                ox[k] = oy[k] = oz[k] = 0;
+                idx[k] = idy[k] = idz[k] = 1;
+                tmin[k] = 1;
+                tmax[k] = 0;
+            }
+        }
+    }
+
+    void shrink(int lane, double t) {
+        // A hit at distance t was found for 'lane', no box behind it needs testing
+        float f = static_cast<float>(t);
+        tmax[lane] = (f < t) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+};
+
+// Slack applied to the far distance of the single precision slab tests, so rounding of the
+// origin and inverse direction can not make a ray miss a box it touches.
+const float packet_slab_slack = 1.0f + 1e-5f;
+
+inline int packet_box_mask_scalar(const ray_packet& p, const float* bmin, const float* bmax) {
+    // Slab test of every lane against one box, returns a bit per lane that hits
+    int mask = 0;
+    for (int k = 0; k < p.size; k++) {
+        float t0x = (bmin[0] - p.ox[k]) * p.idx[k], t1x = (bmax[0] - p.ox[k]) * p.idx[k];
+        float t0y = (bmin[1] - p.oy[k]) * p.idy[k], t1y = (bmax[1] - p.oy[k]) * p.idy[k];
+        float t0z = (bmin[2] - p.oz[k]) * p.idz[k], t1z = (bmax[2] - p.oz[k]) * p.idz[k];
+        float t_near = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), p.tmin[k]));
+        float t_far = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), p.tmax[k]));
+        if (t_near <= t_far * packet_slab_slack)
+            mask |= 1 << k;
+    }
+    return mask;
+}
+
+#if RT_X86_SIMD
+inline int packet_box_mask_sse(const ray_packet& p, const float* bmin, const float* bmax) {
+    // Same test as packet_box_mask_scalar, four lanes per instruction
+    const __m128 minx = _mm_set1_ps(bmin[0]), miny = _mm_set1_ps(bmin[1]), minz = _mm_set1_ps(bmin[2]);
+    const __m128 maxx = _mm_set1_ps(bmax[0]), maxy = _mm_set1_ps(bmax[1]), maxz = _mm_set1_ps(bmax[2]);
+    const __m128 slack = _mm_set1_ps(packet_slab_slack);
+
+    int mask = 0;
+    for (int base = 0; base < p.size; base += 4) {
+        __m128 ox = _mm_load_ps(p.ox + base), oy = _mm_load_ps(p.oy + base), oz = _mm_load_ps(p.oz + base);
+        __m128 ix = _mm_load_ps(p.idx + base), iy = _mm_load_ps(p.idy + base), iz = _mm_load_ps(p.idz + base);
+
+        __m128 t0x = _mm_mul_ps(_mm_sub_ps(minx, ox), ix), t1x = _mm_mul_ps(_mm_sub_ps(maxx, ox), ix);
+        __m128 t0y = _mm_mul_ps(_mm_sub_ps(miny, oy), iy), t1y = _mm_mul_ps(_mm_sub_ps(maxy, oy), iy);
+        __m128 t0z = _mm_mul_ps(_mm_sub_ps(minz, oz), iz), t1z = _mm_mul_ps(_mm_sub_ps(maxz, oz), iz);
+
+        __m128 t_near = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+                                   _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_load_ps(p.tmin + base)));
+        __m128 t_far = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+                                  _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_load_ps(p.tmax + base)));
+
+        mask |= _mm_movemask_ps(_mm_cmple_ps(t_near, _mm_mul_ps(t_far, slack))) << base;
+    }
+    return mask & ((1 << p.size) - 1);
+}
+
+RT_TARGET_AVX2
+inline int packet_box_mask_avx2(const ray_packet& p, const float* bmin, const float* bmax) {
+    // Same test as packet_box_mask_scalar, eight lanes per instruction
+    const __m256 minx = _mm256_set1_ps(bmin[0]), miny = _mm256_set1_ps(bmin[1]), minz = _mm256_set1_ps(bmin[2]);
+    const __m256 maxx = _mm256_set1_ps(bmax[0]), maxy = _mm256_set1_ps(bmax[1]), maxz = _mm256_set1_ps(bmax[2]);
+
+    __m256 ox = _mm256_load_ps(p.ox), oy = _mm256_load_ps(p.oy), oz = _mm256_load_ps(p.oz);
+    __m256 ix = _mm256_load_ps(p.idx), iy = _mm256_load_ps(p.idy), iz = _mm256_load_ps(p.idz);
+
+    __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(minx, ox), ix), t1x = _mm256_mul_ps(_mm256_sub_ps(maxx, ox), ix);
+    __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(miny, oy), iy), t1y = _mm256_mul_ps(_mm256_sub_ps(maxy, oy), iy);
+    __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(minz, oz), iz), t1z = _mm256_mul_ps(_mm256_sub_ps(maxz, oz), iz);
+
+    __m256 t_near = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)),
+                                  _mm256_max_ps(_mm256_min_ps(t0z, t1z), _mm256_load_ps(p.tmin)));
+    __m256 t_far = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)),
+                                 _mm256_min_ps(_mm256_max_ps(t0z, t1z), _mm256_load_ps(p.tmax)));
+    t_far = _mm256_mul_ps(t_far, _mm256_set1_ps(packet_slab_slack));
+
+    return _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ)) & ((1 << p.size) - 1);
+}
+#endif
+
+typedef int (*packet_box_kernel)(const ray_packet&, const float*, const float*);
+
+inline packet_box_kernel select_packet_box_kernel() {
+    // Pick the slab test kernel once, from what the CPU supports
+    static const packet_box_kernel kernel = []() -> packet_box_kernel {
+#if RT_X86_SIMD
+        simd_level level = detect_simd_level();
+        if (level == simd_level::avx2)
+            return packet_box_mask_avx2;
+        if (level == simd_level::sse)
+            return packet_box_mask_sse;
+#endif
+        return packet_box_mask_scalar;
+    }();
+    return kernel;
+}
+
+#endif
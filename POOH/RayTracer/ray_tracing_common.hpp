@@ -10,6 +10,9 @@
 #include <memory>
 // Standard C++ memory management library
 
+#include "sampler.hpp"
+// Include the sampler header file for the per-sample random number generator
+
 
 // Usings
 
@@ -36,9 +39,21 @@ inline double degrees_to_radians(double degrees) {
 
 inline double random_double() {
     // Returns a random real in [0,1).
+    // Shared global generator: only used while building the scene (perlin tables, BVH),
+    // everything on the rendering path takes a sampler instead.
     return rand() / (RAND_MAX + 1.0);
 }
 
+inline double random_double(sampler& rng) {
+    // Returns a random real in [0,1) drawn from the given sampler.
+    return rng.next_double();
+}
+
+inline double random_double(sampler& rng, double min, double max) {
+    // Returns a random real in [min,max) drawn from the given sampler.
+    return min + (max-min)*random_double(rng);
+}
+
 inline double random_double(double min, double max) {
     // Returns a random real in [min,max).
     return min + (max-min)*random_double();
@@ -0,0 +1,24 @@
+#ifndef RENDER_PROGRESS_H
+#define RENDER_PROGRESS_H
+
+#include <atomic>
+// Include the atomic header file for the counters shared with the render threads
+#include <cstdint>
+// Include the cstdint header file for the counters
+
+struct render_progress {
+    // Counters a render updates as it goes, readable from any thread while it runs.
+    // The render threads only touch them once per tile, never per sample or per ray.
+    std::atomic<uint64_t> tiles_total{0};
+    // Tiles the render will trace (over every pass of a progressive render)
+    std::atomic<uint64_t> tiles_done{0};
+    // Tiles finished so far
+    std::atomic<uint64_t> samples_done{0};
+    // Camera samples traced so far
+    std::atomic<uint64_t> rays_traced{0};
+    // Rays traced so far (camera rays, bounces and shadow rays)
+    std::atomic<bool> cancel{false};
+    // Set to stop the render: every thread drops out after the tile it is on
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <cstdint>
+// Include the cstdint header file for the counters
+#include <fstream>
+// Include the fstream header file to write the JSON report
+#include <mutex>
+// Include the mutex header file to gather the counters of the threads
+#include <string>
+// Include the string header file for the report path
+
+struct render_counters {
+    // Events counted on the hot paths, per thread
+    uint64_t primary_rays = 0;
+    // Camera rays
+    uint64_t secondary_rays = 0;
+    // Bounces traced after a scatter
+    uint64_t shadow_rays = 0;
+    // Rays toward a light (next event estimation)
+    uint64_t bvh_nodes_visited = 0;
+    // BVH nodes whose children or primitives were tested
+    uint64_t primitive_tests = 0;
+    // Ray against sphere or quad tests
+    uint64_t scatter_events = 0;
+    // Surface interactions of lambertian, metal and dielectric materials
+    uint64_t roulette_terminations = 0;
+    // Paths ended by Russian roulette
+
+    void add(const render_counters& other) {
+        primary_rays += other.primary_rays;
+        secondary_rays += other.secondary_rays;
+        shadow_rays += other.shadow_rays;
+        bvh_nodes_visited += other.bvh_nodes_visited;
+        primitive_tests += other.primitive_tests;
+        scatter_events += other.scatter_events;
+        roulette_terminations += other.roulette_terminations;
+    }
+};
+
+inline render_counters& thread_counters() {
+    // Counters of the calling thread: the hot paths only ever touch their own thread's copy
+    static thread_local render_counters counters;
+    return counters;
+}
+
+// Counting is compiled in only with RT_ENABLE_STATS, otherwise these expand to nothing
+// and the hot paths are exactly as without instrumentation
+#ifdef RT_ENABLE_STATS
+#define RT_STAT_ADD(counter, n) (thread_counters().counter += (n))
+#else
+#define RT_STAT_ADD(counter, n) ((void)0)
+#endif
+#define RT_STAT(counter) RT_STAT_ADD(counter, 1)
+
+struct render_stats {
+    // Statistics of one render: the counters of every thread, added up once per thread at
+    // the end of each parallel region, and the wall time of each phase
+    render_counters counters;
+    double scene_seconds = 0;
+    // Building the primitive and material tables
+    double bvh_seconds = 0;
+    // Building the BVH
+    double trace_seconds = 0;
+    // Tracing the image
+    double write_seconds = 0;
+    // Writing the output files
+    int threads = 0;
+    int width = 0;
+    int height = 0;
+    int samples_per_pixel = 0;
+    uint64_t samples_taken = 0;
+    std::mutex mutex;
+
+    void gather() {
+        // Add the calling thread's counters to the render
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.add(thread_counters());
+    }
+
+    bool write_json(const std::string& path) const {
+        // Write the statistics as a JSON object, returns false if the file could not be written
+        const render_counters& c = counters;
+        uint64_t rays = c.primary_rays + c.secondary_rays + c.shadow_rays;
+        auto ratio = [](double a, double b) { return (b > 0) ? a / b : 0.0; };
+
+        std::ofstream out(path);
+        out << "{\n"
+#ifdef RT_ENABLE_STATS
+            << "  \"counters_enabled\": true,\n"
+#else
+            << "  \"counters_enabled\": false,\n"
+#endif
+            << "  \"image\": {\"width\": " << width << ", \"height\": " << height
+            << ", \"samples_per_pixel\": " << samples_per_pixel << ", \"samples_taken\": " << samples_taken << "},\n"
+            << "  \"threads\": " << threads << ",\n"
+            << "  \"seconds\": {\"scene\": " << scene_seconds << ", \"bvh\": " << bvh_seconds
+            << ", \"trace\": " << trace_seconds << ", \"write\": " << write_seconds << "},\n"
+            << "  \"rays\": {\"primary\": " << c.primary_rays << ", \"secondary\": " << c.secondary_rays
+            << ", \"shadow\": " << c.shadow_rays << ", \"total\": " << rays
+            << ", \"per_second\": " << ratio(static_cast<double>(rays), trace_seconds) << "},\n"
+            << "  \"average_path_length\": " << ratio(static_cast<double>(c.primary_rays + c.secondary_rays), static_cast<double>(c.primary_rays)) << ",\n"
+            << "  \"bvh_nodes_visited\": " << c.bvh_nodes_visited << ",\n"
+            << "  \"bvh_nodes_per_ray\": " << ratio(static_cast<double>(c.bvh_nodes_visited), static_cast<double>(rays)) << ",\n"
+            << "  \"primitive_tests\": " << c.primitive_tests << ",\n"
+            << "  \"primitive_tests_per_ray\": " << ratio(static_cast<double>(c.primitive_tests), static_cast<double>(rays)) << ",\n"
+            << "  \"scatter_events\": " << c.scatter_events << ",\n"
+            << "  \"roulette_terminations\": " << c.roulette_terminations << "\n"
+            << "}\n";
+        return static_cast<bool>(out);
+    }
+};
+
+#endif
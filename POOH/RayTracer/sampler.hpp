@@ -0,0 +1,55 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+// Include the cstdint header file for fixed width integers
+
+class sampler {
+    // Random number generator used on the sampling path (camera, materials).
+    // Every camera sample owns its own generator, keyed by (seed, pixel, sample index),
+    // so there is no shared state between threads and an image only depends on the seed,
+    // not on the number of threads or on which thread rendered which pixel.
+    // The numbers come from a PCG32 generator whose state and stream are derived
+    // from the key with the SplitMix64 finalizer.
+  public:
+    sampler() : state(0), inc(1) {}
+    // Placeholder generator, meant to be overwritten by a keyed one
+
+    sampler(uint64_t seed, uint64_t pixel_index, uint64_t sample_index) {
+        inc = (mix(seed ^ mix(pixel_index + 0x632BE59BD9B4E019ull)) << 1) | 1u;
+        // Odd stream increment, one stream per pixel
+        state = mix(mix(seed + sample_index) ^ pixel_index);
+        // Starting state, one per sample of the pixel
+        next_uint();
+    }
+
+    uint32_t next_uint() {
+        // Returns the next 32 random bits (PCG32, XSH RR output)
+        uint64_t old = state;
+        state = old * 6364136223846793005ull + inc;
+        uint32_t xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = static_cast<uint32_t>(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+    }
+
+    double next_double() {
+        // Returns a random real in [0,1)
+        return next_uint() * (1.0 / 4294967296.0);
+    }
+
+  private:
+    uint64_t state;
+    // Current state of the generator
+    uint64_t inc;
+    // Stream selector (always odd)
+
+    static uint64_t mix(uint64_t z) {
+        // SplitMix64 finalizer, spreads the key bits over the whole word
+        z += 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef SCENE_DESCRIPTION_H
+#define SCENE_DESCRIPTION_H
+
+#include "ray_tracing_common.hpp"
+// Include the ray_tracing_common header file for the point3 and vec3 types
+#include "color.hpp"
+// Include the color header file for color representation
+
+#include <cstdint>
+// Include the cstdint header file for the material indices
+#include <vector>
+// Include the vector header file for the scene tables
+
+enum class material_kind : uint8_t {
+    lambertian = 0,
+    // Checker texture of albedo and albedo2
+    metal = 1,
+    // Reflects albedo, blurred by parameter (fuzz)
+    dielectric = 2,
+    // Glass of refraction index parameter
+    diffuse_light = 3
+    // Emits albedo
+};
+
+enum class shape_kind : uint8_t {
+    sphere = 0,
+    quad = 1,
+    box = 2
+};
+
+struct material_description {
+    // One material of a scene file, plain values only
+    material_kind kind = material_kind::lambertian;
+    color albedo;
+    // First color (Colors)
+    color albedo2;
+    // Second checker color (Colors2), only used by lambertian
+    double parameter = 0;
+    // Fuzz of a metal or refraction index of a dielectric
+};
+
+struct primitive_description {
+    // One object of a scene file. The meaning of p, u and v depends on the shape:
+    //   sphere: p is the center at time 0, u the center at time 1, radius the radius
+    //   quad:   p is the corner (Origen), u and v the two edges (Vector1, Vector2)
+    //   box:    p and u are two opposite corners (Point1, Point2)
+    shape_kind kind = shape_kind::sphere;
+    uint32_t material = 0;
+    // Index in scene_description::materials
+    point3 p;
+    vec3 u;
+    vec3 v;
+    double radius = 0;
+};
+
+struct camera_description {
+    // One camera of a scene file
+    point3 lookfrom;
+    point3 lookat;
+    vec3 vup = vec3(0, 1, 0);
+    double vfov = 90;
+    // Vertical field of view in degrees
+    color background;
+    // Color of the rays that leave the scene
+};
+
+struct scene_description {
+    // Typed contents of a scene file, read in one pass and handed to the renderer as is
+    std::vector<camera_description> cameras;
+    std::vector<material_description> materials;
+    std::vector<primitive_description> primitives;
+};
+
+#endif
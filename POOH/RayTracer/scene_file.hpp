@@ -0,0 +1,291 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "scene_description.hpp"
+// Include the scene description header file for the cameras and materials
+#include "scene_geometry.hpp"
+// Include the scene geometry header file for the primitive tables
+#include "flat_bvh.hpp"
+// Include the flat BVH header file for the optional prebuilt hierarchy
+#include "mapped_file.hpp"
+// Include the mapped file header file to use the file in place
+
+#include <cstdint>
+// Include the cstdint header file for the fixed width fields
+#include <cstring>
+// Include the cstring header file to check the magic
+#include <fstream>
+// Include the fstream header file to write the file
+#include <string>
+// Include the string header file for the file name
+#include <type_traits>
+// Include the type_traits header file for the element type of each table
+#include <vector>
+// Include the vector header file for the section list
+
+struct scene_file_header {
+    // First bytes of a scene file
+    char magic[8];
+    // "RTSCENE"
+    uint32_t version;
+    uint32_t byte_order;
+    // 0x01020304 in the byte order of the machine that wrote the file
+    uint64_t scene_hash;
+    // FNV-1a hash of the scene description
+    double bounds[6];
+    // Bounding box of the geometry: minimum x, y, z then maximum x, y, z
+    uint32_t section_count;
+    uint32_t reserved;
+};
+
+struct scene_file_section {
+    // Where one array of the file is
+    uint64_t offset;
+    // From the start of the file, a multiple of 64
+    uint64_t count;
+    // Number of elements
+    uint32_t element_size;
+    // Size of one element in bytes
+    uint32_t reserved;
+};
+
+struct scene_file_camera {
+    double lookfrom[3];
+    double lookat[3];
+    double vup[3];
+    double background[3];
+    double vfov;
+};
+
+struct scene_file_material {
+    uint32_t kind;
+    // material_kind
+    uint32_t reserved;
+    double albedo[3];
+    double albedo2[3];
+    double parameter;
+};
+
+class scene_file {
+    // Binary scene file, meant to be mapped in memory and used in place:
+    //
+    //   header         scene_file_header
+    //   section table  one scene_file_section per section
+    //   sections       each 64 byte aligned, in this order: cameras, materials, every
+    //                  primitive table of scene_geometry (in visit_tables order), then the
+    //                  nodes and the primitive order of a flat_bvh (both empty without a BVH)
+    //
+    // The primitive tables and the BVH are the arrays the renderer works on, so loading
+    // attaches them to the mapping instead of reading them: no per-primitive work besides
+    // a range check, and pages are only read from disk when a ray first needs them. Only
+    // the materials are built, one object per entry of the (deduplicated) material table.
+    // Numbers are in the byte order of the machine that wrote the file; files written with
+    // the other byte order or another version are refused.
+  public:
+    static constexpr uint32_t version = 1;
+    static constexpr uint32_t byte_order_mark = 0x01020304;
+    static constexpr uint64_t alignment = 64;
+
+    static bool write(const std::string& path, const std::vector<camera_description>& cameras,
+                      const std::vector<material_description>& materials, const scene_geometry& geometry,
+                      const flat_bvh* bvh, uint64_t scene_hash) {
+        // Write a scene: the geometry must have been built from 'materials' (same indices),
+        // bvh may be null. Returns false if the file could not be written.
+        std::vector<scene_file_camera> camera_records(cameras.size());
+        for (size_t i = 0; i < cameras.size(); i++) {
+            const camera_description& c = cameras[i];
+            scene_file_camera& r = camera_records[i];
+            store(r.lookfrom, c.lookfrom);
+            store(r.lookat, c.lookat);
+            store(r.vup, c.vup);
+            store(r.background, c.background);
+            r.vfov = c.vfov;
+        }
+        std::vector<scene_file_material> material_records(materials.size());
+        for (size_t i = 0; i < materials.size(); i++) {
+            const material_description& m = materials[i];
+            scene_file_material& r = material_records[i];
+            r.kind = static_cast<uint32_t>(m.kind);
+            r.reserved = 0;
+            store(r.albedo, m.albedo);
+            store(r.albedo2, m.albedo2);
+            r.parameter = m.parameter;
+        }
+
+        struct block { const void* data; uint64_t count; uint32_t element_size; };
+        std::vector<block> blocks;
+        blocks.push_back({camera_records.data(), camera_records.size(), sizeof(scene_file_camera)});
+        blocks.push_back({material_records.data(), material_records.size(), sizeof(scene_file_material)});
+        geometry.visit_tables([&](const auto& t) {
+            blocks.push_back({t.data(), t.size(), static_cast<uint32_t>(sizeof(*t.data()))});
+        });
+        if (bvh) {
+            blocks.push_back({bvh->node_array().data(), bvh->node_array().size(), sizeof(flat_bvh_node)});
+            blocks.push_back({bvh->primitive_order().data(), bvh->primitive_order().size(), sizeof(uint32_t)});
+        } else {
+            blocks.push_back({nullptr, 0, sizeof(flat_bvh_node)});
+            blocks.push_back({nullptr, 0, sizeof(uint32_t)});
+        }
+
+        scene_file_header header = {};
+        std::memcpy(header.magic, "RTSCENE", 8);
+        header.version = version;
+        header.byte_order = byte_order_mark;
+        header.scene_hash = scene_hash;
+        aabb box = geometry.bounding_box();
+        for (int a = 0; a < 3; a++) {
+            header.bounds[a] = box.axis(a).min;
+            header.bounds[3 + a] = box.axis(a).max;
+        }
+        header.section_count = static_cast<uint32_t>(blocks.size());
+
+        std::vector<scene_file_section> sections(blocks.size());
+        uint64_t offset = sizeof(scene_file_header) + blocks.size() * sizeof(scene_file_section);
+        for (size_t k = 0; k < blocks.size(); k++) {
+            offset = (offset + alignment - 1) / alignment * alignment;
+            sections[k] = {offset, blocks[k].count, blocks[k].element_size, 0};
+            offset += blocks[k].count * blocks[k].element_size;
+        }
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof header);
+        out.write(reinterpret_cast<const char*>(sections.data()), sections.size() * sizeof(scene_file_section));
+        uint64_t written = sizeof header + sections.size() * sizeof(scene_file_section);
+        const char zeros[alignment] = {};
+        for (size_t k = 0; k < blocks.size(); k++) {
+            out.write(zeros, static_cast<std::streamsize>(sections[k].offset - written));
+            uint64_t bytes = blocks[k].count * blocks[k].element_size;
+            if (bytes > 0)
+                out.write(static_cast<const char*>(blocks[k].data), static_cast<std::streamsize>(bytes));
+            written = sections[k].offset + bytes;
+        }
+        out.close();
+        return static_cast<bool>(out);
+    }
+
+    static bool is_scene_file(const std::string& path) {
+        // True if the file starts like a scene file (of any version)
+        char magic[8] = {};
+        std::ifstream in(path, std::ios::binary);
+        return in.read(magic, sizeof magic) && std::memcmp(magic, "RTSCENE", 8) == 0;
+    }
+
+    bool open(const std::string& path) {
+        // Map a scene file and check its header and section table
+        file = make_shared<mapped_file>();
+        if (!file->open(path) || file->size() < sizeof(scene_file_header)) {
+            file.reset();
+            return false;
+        }
+        const scene_file_header* h = header();
+        size_t expected_sections = 4 + geometry_table_count();
+        bool valid = std::memcmp(h->magic, "RTSCENE", 8) == 0 && h->version == version &&
+                     h->byte_order == byte_order_mark && h->section_count == expected_sections &&
+                     file->size() >= sizeof(scene_file_header) + expected_sections * sizeof(scene_file_section);
+        for (size_t k = 0; valid && k < expected_sections; k++) {
+            const scene_file_section& s = section(k);
+            valid = s.offset % alignment == 0 && s.element_size > 0 && s.offset <= file->size() &&
+                    s.count <= (file->size() - s.offset) / s.element_size;
+        }
+        valid = valid && section(0).element_size == sizeof(scene_file_camera) &&
+                section(1).element_size == sizeof(scene_file_material);
+        for (size_t i = 0; valid && i < section(1).count; i++)
+            valid = records<scene_file_material>(1)[i].kind <= static_cast<uint32_t>(material_kind::diffuse_light);
+        if (!valid)
+            file.reset();
+        return valid;
+    }
+
+    uint64_t hash() const { return header()->scene_hash; }
+    // Hash of the scene description the file was written from
+
+    size_t camera_count() const { return section(0).count; }
+    camera_description camera(size_t i) const {
+        const scene_file_camera& r = records<scene_file_camera>(0)[i];
+        camera_description c;
+        c.lookfrom = load(r.lookfrom);
+        c.lookat = load(r.lookat);
+        c.vup = load(r.vup);
+        c.background = load(r.background);
+        c.vfov = r.vfov;
+        return c;
+    }
+
+    size_t material_count() const { return section(1).count; }
+    material_description material(size_t i) const {
+        const scene_file_material& r = records<scene_file_material>(1)[i];
+        material_description m;
+        m.kind = static_cast<material_kind>(r.kind);
+        m.albedo = load(r.albedo);
+        m.albedo2 = load(r.albedo2);
+        m.parameter = r.parameter;
+        return m;
+    }
+
+    bool attach(scene_geometry& geometry) const {
+        // Point the primitive tables of 'geometry', which already holds the materials of the
+        // file, at the mapping. The geometry keeps the mapping alive.
+        size_t k = 2;
+        bool valid = true;
+        geometry.visit_tables([&](auto& t) {
+            using element = typename std::remove_reference<decltype(*t.data())>::type;
+            valid = valid && section(k).element_size == sizeof(element);
+            if (valid)
+                t.attach(records<element>(k), section(k).count);
+            k++;
+        });
+        const double* b = header()->bounds;
+        aabb bounds(point3(b[0], b[1], b[2]), point3(b[3], b[4], b[5]));
+        return valid && geometry.adopt_tables(file, bounds);
+    }
+
+    bool has_bvh() const { return section(bvh_section()).count > 0; }
+    // True if the file holds a prebuilt BVH
+
+    shared_ptr<flat_bvh> bvh(shared_ptr<const scene_geometry> geometry) const {
+        // The stored BVH over an attached geometry, used in place (null if it does not fit the
+        // geometry, or its links could send a traversal out of the tables or past its stack)
+        const scene_file_section& node_section = section(bvh_section());
+        const scene_file_section& order_section = section(bvh_section() + 1);
+        if (node_section.element_size != sizeof(flat_bvh_node) || order_section.element_size != sizeof(uint32_t))
+            return nullptr;
+
+        table<flat_bvh_node> nodes;
+        nodes.attach(records<flat_bvh_node>(bvh_section()), node_section.count);
+        table<uint32_t> order;
+        order.attach(records<uint32_t>(bvh_section() + 1), order_section.count);
+        if (!flat_bvh::valid_layout(nodes, order, geometry->primitive_count()))
+            return nullptr;
+        return make_shared<flat_bvh>(geometry, nodes, order, file);
+    }
+
+  private:
+    shared_ptr<mapped_file> file;
+
+    static size_t geometry_table_count() {
+        scene_geometry g;
+        size_t n = 0;
+        g.visit_tables([&](const auto&) { n++; });
+        return n;
+    }
+
+    static size_t bvh_section() { return 2 + geometry_table_count(); }
+
+    const scene_file_header* header() const { return reinterpret_cast<const scene_file_header*>(file->data()); }
+    const scene_file_section& section(size_t k) const {
+        return reinterpret_cast<const scene_file_section*>(file->data() + sizeof(scene_file_header))[k];
+    }
+
+    template <typename T>
+    T* records(size_t k) const { return reinterpret_cast<T*>(file->data() + section(k).offset); }
+
+    static void store(double* out, const vec3& v) {
+        out[0] = v.x();
+        out[1] = v.y();
+        out[2] = v.z();
+    }
+
+    static vec3 load(const double* in) { return vec3(in[0], in[1], in[2]); }
+};
+
+#endif
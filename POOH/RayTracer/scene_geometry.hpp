@@ -0,0 +1,540 @@
+#ifndef SCENE_GEOMETRY_H
+#define SCENE_GEOMETRY_H
+
+#include "ray_tracing_common.hpp"
+// Include the ray_tracing_common header file for common ray tracing utilities
+
+#include "hittable.hpp"
+// Include the hittable header file for hittable object representation
+#include "sphere.hpp"
+// Include the sphere header file for the shared sphere intersection
+#include "quad.hpp"
+// Include the quad header file for the shared quad intersection
+#include "light_list.hpp"
+// Include the light list header file for the emissive primitives
+#include "render_stats.hpp"
+// Include the render stats header file for the hot path counters
+#include "table.hpp"
+// Include the table header file for the primitive arrays
+#include "hash.hpp"
+// Include the hash header file for the shape hash
+
+#include <cstdint>
+// Include the cstdint header file for the primitive references
+#include <initializer_list>
+// Include the initializer_list header file to compare the table sizes
+#include <vector>
+// Include the vector header file for the material and custom object lists
+
+class scene_geometry : public hittable {
+    // Geometry of a scene stored by primitive type: spheres, moving spheres and quads live
+    // in contiguous structure-of-arrays tables with a material index, instead of one heap
+    // object per primitive behind a shared_ptr<hittable>. Intersections dispatch on the
+    // primitive type with a switch, no virtual call and no pointer chase.
+    // Any other hittable can still be added as a custom object (tested through its virtual hit).
+    //
+    // Every primitive has an index in [0, primitive_count()), which is what the BVHs store.
+  public:
+    enum primitive_type : uint32_t {
+        sphere_type = 0,
+        moving_sphere_type = 1,
+        quad_type = 2,
+        object_type = 3
+    };
+
+    uint32_t add_material(shared_ptr<material> m) {
+        // Register a material, returns its index for the add_* functions
+        materials.push_back(m);
+        return static_cast<uint32_t>(materials.size() - 1);
+    }
+
+    void add_sphere(const point3& center, double radius, uint32_t mat) {
+        // Add a stationary sphere
+        uint32_t i = new_slot(sphere_type, spheres.mat.size());
+        write_sphere(i, center, radius, mat);
+        add_reference(sphere_type, i);
+        if (is_emissive(mat))
+            emitters.add_sphere(center, radius, materials[mat].get());
+    }
+
+    void add_moving_sphere(const point3& center1, const point3& center2, double radius, uint32_t mat) {
+        // Add a sphere moving from center1 (time 0) to center2 (time 1), never sampled as a light
+        uint32_t i = new_slot(moving_sphere_type, moving.mat.size());
+        write_moving_sphere(i, center1, center2, radius, mat);
+        add_reference(moving_sphere_type, i);
+    }
+
+    void add_quad(const point3& Q, const vec3& u, const vec3& v, uint32_t mat) {
+        // Add a parallelogram with corner Q and edges u and v
+        uint32_t i = new_slot(quad_type, quads.mat.size());
+        write_quad(i, Q, u, v, mat);
+        add_reference(quad_type, i);
+        if (is_emissive(mat))
+            emitters.add_quad(Q, u, v, materials[mat].get());
+    }
+
+    void add_box(const point3& a, const point3& b, uint32_t mat) {
+        // Add the six quads of the box with opposite vertices a and b (same sides as box())
+        point3 Q[6];
+        vec3 u[6], v[6];
+        box_sides(a, b, Q, u, v);
+        for (int k = 0; k < 6; k++)
+            add_quad(Q[k], u[k], v[k], mat);
+    }
+
+    static void box_sides(const point3& a, const point3& b, point3 Q[6], vec3 u[6], vec3 v[6]) {
+        // Corner and edges of the six sides of the box with opposite vertices a and b:
+        // front, right, back, left, top and bottom
+        auto min = point3(fmin(a.x(), b.x()), fmin(a.y(), b.y()), fmin(a.z(), b.z()));
+        auto max = point3(fmax(a.x(), b.x()), fmax(a.y(), b.y()), fmax(a.z(), b.z()));
+
+        auto dx = vec3(max.x() - min.x(), 0, 0);
+        auto dy = vec3(0, max.y() - min.y(), 0);
+        auto dz = vec3(0, 0, max.z() - min.z());
+
+        Q[0] = point3(min.x(), min.y(), max.z()); u[0] =  dx; v[0] =  dy; // front
+        Q[1] = point3(max.x(), min.y(), max.z()); u[1] = -dz; v[1] =  dy; // right
+        Q[2] = point3(max.x(), min.y(), min.z()); u[2] = -dx; v[2] =  dy; // back
+        Q[3] = point3(min.x(), min.y(), min.z()); u[3] =  dz; v[3] =  dy; // left
+        Q[4] = point3(min.x(), max.y(), max.z()); u[4] =  dx; v[4] = -dz; // top
+        Q[5] = point3(min.x(), min.y(), min.z()); u[5] =  dx; v[5] =  dz; // bottom
+    }
+
+    void add_object(shared_ptr<hittable> object) {
+        // Add any other hittable, it keeps its own material
+        uint32_t i = new_slot(object_type, objects.size());
+        if (i == objects.size())
+            objects.push_back(object);
+        else
+            objects[i] = object;
+        add_reference(object_type, i);
+    }
+
+    // Edits of a geometry that is already in use. A primitive keeps its index when it is
+    // changed in place, so a BVH only has to refit it; removing a primitive gives its index
+    // to the last one. The lights and the bounding box are brought up to date by
+    // update_lights and update_bounds.
+
+    void set_sphere(uint32_t prim, const point3& center, double radius, uint32_t mat) {
+        // Change a stationary sphere
+        lights_stale = lights_stale || is_emissive(spheres.mat[slot_of(prim)]) || is_emissive(mat);
+        write_sphere(slot_of(prim), center, radius, mat);
+        bbox = aabb(bbox, primitive_bounds(prim));
+        bounds_stale = true;
+    }
+
+    void set_moving_sphere(uint32_t prim, const point3& center1, const point3& center2, double radius, uint32_t mat) {
+        // Change a moving sphere
+        write_moving_sphere(slot_of(prim), center1, center2, radius, mat);
+        bbox = aabb(bbox, primitive_bounds(prim));
+        bounds_stale = true;
+    }
+
+    void set_quad(uint32_t prim, const point3& Q, const vec3& u, const vec3& v, uint32_t mat) {
+        // Change a parallelogram
+        lights_stale = lights_stale || is_emissive(quads.mat[slot_of(prim)]) || is_emissive(mat);
+        write_quad(slot_of(prim), Q, u, v, mat);
+        bbox = aabb(bbox, primitive_bounds(prim));
+        bounds_stale = true;
+    }
+
+    uint32_t remove_primitive(uint32_t prim) {
+        // Remove a primitive. The last primitive takes its index: the returned value is the
+        // index that primitive had (prim itself if it was the last one). The table slot of
+        // the removed primitive is reused by the next add of the same type.
+        uint32_t type = refs[prim] >> type_shift, slot = slot_of(prim);
+        if (type == sphere_type)
+            lights_stale = lights_stale || is_emissive(spheres.mat[slot]);
+        else if (type == quad_type)
+            lights_stale = lights_stale || is_emissive(quads.mat[slot]);
+        else if (type == object_type)
+            objects[slot].reset();
+        free_slots[type].push_back(slot);
+        bounds_stale = true;
+
+        uint32_t last = static_cast<uint32_t>(refs.size() - 1);
+        refs[prim] = refs[last];
+        refs.resize(last);
+        return last;
+    }
+
+    void set_material(uint32_t index, shared_ptr<material> m) {
+        // Replace an entry of the material table, every primitive using it changes with it
+        lights_stale = lights_stale || is_emissive(index) || (m && m->is_emissive());
+        materials[index] = m;
+    }
+
+    void update_lights() {
+        // Collect the emissive primitives again if an edit may have changed them
+        if (!lights_stale)
+            return;
+        emitters = light_list();
+        for (uint32_t prim = 0; prim < refs.size(); prim++) {
+            uint32_t i = slot_of(prim);
+            if (type_of(prim) == sphere_type && is_emissive(spheres.mat[i]))
+                emitters.add_sphere(load(spheres.cx, spheres.cy, spheres.cz, i), spheres.radius[i],
+                                    materials[spheres.mat[i]].get());
+            else if (type_of(prim) == quad_type && is_emissive(quads.mat[i]))
+                emitters.add_quad(load(quads.qx, quads.qy, quads.qz, i), load(quads.ux, quads.uy, quads.uz, i),
+                                  load(quads.vx, quads.vy, quads.vz, i), materials[quads.mat[i]].get());
+        }
+        lights_stale = false;
+    }
+
+    void update_bounds() {
+        // Shrink the bounding box to the primitives if an edit removed or moved one (until
+        // then it still encloses every primitive, only more loosely)
+        if (!bounds_stale)
+            return;
+        bbox = aabb();
+        for (uint32_t prim = 0; prim < refs.size(); prim++)
+            bbox = aabb(bbox, primitive_bounds(prim));
+        bounds_stale = false;
+    }
+
+    shared_ptr<scene_geometry> copy() const {
+        // Copy that can be edited while this geometry is still in use: attached tables are
+        // copied into memory of its own, the materials and custom objects are shared
+        auto other = make_shared<scene_geometry>(*this);
+        auto own = [](auto& t) { t.own(); };
+        visit_tables(*other, own);
+        other->storage.reset();
+        return other;
+    }
+
+    size_t primitive_count() const { return refs.size(); }
+    // Number of primitives of every type
+
+    primitive_type type_of(uint32_t prim) const { return static_cast<primitive_type>(refs[prim] >> type_shift); }
+    // Type of a primitive
+    uint32_t slot_of(uint32_t prim) const { return refs[prim] & slot_mask; }
+    // Index of a primitive inside the table of its type
+
+    aabb primitive_bounds(uint32_t prim) const {
+        // Bounding box of one primitive
+        uint32_t i = slot_of(prim);
+        switch (type_of(prim)) {
+        case sphere_type: {
+            vec3 rvec(spheres.radius[i], spheres.radius[i], spheres.radius[i]);
+            point3 c = load(spheres.cx, spheres.cy, spheres.cz, i);
+            return aabb(c - rvec, c + rvec);
+        }
+        case moving_sphere_type: {
+            vec3 rvec(moving.radius[i], moving.radius[i], moving.radius[i]);
+            point3 c1 = load(moving.cx, moving.cy, moving.cz, i);
+            point3 c2 = c1 + load(moving.dx, moving.dy, moving.dz, i);
+            return aabb(aabb(c1 - rvec, c1 + rvec), aabb(c2 - rvec, c2 + rvec));
+        }
+        case quad_type:
+            return quad_bounds(load(quads.qx, quads.qy, quads.qz, i),
+                               load(quads.ux, quads.uy, quads.uz, i),
+                               load(quads.vx, quads.vy, quads.vz, i));
+        default:
+            return objects[i]->bounding_box();
+        }
+    }
+
+    bool intersect_primitive(uint32_t prim, const ray& r, const interval& ray_t, double& t, hit_record& rec) const {
+        // Distance to a primitive inside ray_t. Typed primitives only report t: the hit record
+        // is filled once per ray, by finalize_hit, for the closest primitive. Custom objects
+        // fill rec themselves (finalize_hit leaves it alone).
+        uint32_t i = slot_of(prim);
+        RT_STAT(primitive_tests);
+        switch (type_of(prim)) {
+        case sphere_type:
+            return hit_sphere_distance(load(spheres.cx, spheres.cy, spheres.cz, i), spheres.radius[i], r, ray_t, t);
+        case moving_sphere_type:
+            return hit_sphere_distance(moving_center(i, r.time()), moving.radius[i], r, ray_t, t);
+        case quad_type: {
+            double alpha, beta;
+            if (!hit_quad(i, r, ray_t, t, alpha, beta))
+                return false;
+            return true;
+        }
+        default:
+            if (!objects[i]->hit(r, ray_t, rec))
+                return false;
+            t = rec.t;
+            return true;
+        }
+    }
+
+    void finalize_hit(uint32_t prim, const ray& r, double t, hit_record& rec) const {
+        // Fill the hit record of the closest primitive found by intersect_primitive
+        uint32_t i = slot_of(prim);
+        switch (type_of(prim)) {
+        case sphere_type:
+            set_sphere_hit(load(spheres.cx, spheres.cy, spheres.cz, i), spheres.radius[i], r, t, rec);
+            rec.mat = materials[spheres.mat[i]].get();
+            break;
+        case moving_sphere_type:
+            set_sphere_hit(moving_center(i, r.time()), moving.radius[i], r, t, rec);
+            rec.mat = materials[moving.mat[i]].get();
+            break;
+        case quad_type: {
+            double t_quad, alpha, beta;
+            hit_quad(i, r, interval(-infinity, infinity), t_quad, alpha, beta);
+            rec.t = t;
+            rec.p = r.at(t);
+            rec.u = alpha;
+            rec.v = beta;
+            rec.mat = materials[quads.mat[i]].get();
+            rec.set_face_normal(r, load(quads.nx, quads.ny, quads.nz, i));
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    bool hit_primitive(uint32_t prim, const ray& r, interval ray_t, hit_record& rec) const {
+        // Intersect the ray with one primitive and fill rec on a hit
+        double t;
+        if (!intersect_primitive(prim, r, ray_t, t, rec))
+            return false;
+        finalize_hit(prim, r, t, rec);
+        return true;
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        // Brute force test of every primitive, for scenes too small to need a BVH
+        uint32_t closest = 0;
+        bool hit_anything = false;
+        for (uint32_t p = 0; p < refs.size(); p++) {
+            double t;
+            if (intersect_primitive(p, r, ray_t, t, rec)) {
+                hit_anything = true;
+                closest = p;
+                ray_t.max = t;
+            }
+        }
+        if (hit_anything)
+            finalize_hit(closest, r, ray_t.max, rec);
+        return hit_anything;
+    }
+
+    const material* material_at(uint32_t index) const { return materials[index].get(); }
+    // Material of the scene material table
+    size_t material_count() const { return materials.size(); }
+    // Number of materials in the table
+    const light_list& lights() const { return emitters; }
+    // Emissive spheres and quads, for light sampling
+
+    aabb bounding_box() const override { return bbox; }
+    // Bounding box of the whole geometry
+
+    template <typename F>
+    void visit_tables(F&& f) { visit_tables(*this, f); }
+    template <typename F>
+    void visit_tables(F&& f) const { visit_tables(*this, f); }
+    // Call f on every primitive table in a fixed order, which is the order scene files store them in
+
+    uint64_t shape_hash() const {
+        // FNV-1a hash of every primitive table but the material columns: geometries with the
+        // same hash have the same primitives in the same order, so the same BVH
+        fnv1a hash;
+        visit_tables([&](const auto& t) {
+            const void* column = &t;
+            if (column == &spheres.mat || column == &moving.mat || column == &quads.mat)
+                return;
+            hash.add(t.size());
+            hash.add(t.data(), t.size() * sizeof(*t.data()));
+        });
+        return hash.value;
+    }
+
+    bool adopt_tables(shared_ptr<const void> owner, const aabb& bounds) {
+        // Finish a geometry whose tables were attached to memory kept alive by 'owner' (a
+        // mapped scene file), after its materials were added: check that the tables agree
+        // with each other, find the lights and take the stored bounding box. Returns false
+        // if a reference or a material index is out of range.
+        size_t spheres_n = spheres.mat.size(), moving_n = moving.mat.size(), quads_n = quads.mat.size();
+        bool consistent = true;
+        auto same = [&](size_t n, std::initializer_list<size_t> sizes) {
+            for (size_t size : sizes)
+                consistent = consistent && size == n;
+        };
+        same(spheres_n, {spheres.cx.size(), spheres.cy.size(), spheres.cz.size(), spheres.radius.size()});
+        same(moving_n, {moving.cx.size(), moving.cy.size(), moving.cz.size(), moving.dx.size(), moving.dy.size(),
+                        moving.dz.size(), moving.radius.size()});
+        same(quads_n, {quads.qx.size(), quads.qy.size(), quads.qz.size(), quads.ux.size(), quads.uy.size(),
+                       quads.uz.size(), quads.vx.size(), quads.vy.size(), quads.vz.size(), quads.nx.size(),
+                       quads.ny.size(), quads.nz.size(), quads.d.size(), quads.wx.size(), quads.wy.size(),
+                       quads.wz.size()});
+        same(refs.size(), {spheres_n + moving_n + quads_n});
+        if (!consistent)
+            return false;
+
+        for (uint32_t ref : refs) {
+            uint32_t slot = ref & slot_mask;
+            switch (ref >> type_shift) {
+            case sphere_type: consistent = consistent && slot < spheres_n; break;
+            case moving_sphere_type: consistent = consistent && slot < moving_n; break;
+            case quad_type: consistent = consistent && slot < quads_n; break;
+            default: consistent = false; break;
+            }
+        }
+        for (const table<uint32_t>* mats : {&spheres.mat, &moving.mat, &quads.mat})
+            for (uint32_t m : *mats)
+                consistent = consistent && m < materials.size();
+        if (!consistent)
+            return false;
+
+        for (uint32_t i = 0; i < spheres_n; i++)
+            if (materials[spheres.mat[i]] && materials[spheres.mat[i]]->is_emissive())
+                emitters.add_sphere(load(spheres.cx, spheres.cy, spheres.cz, i), spheres.radius[i],
+                                    materials[spheres.mat[i]].get());
+        for (uint32_t i = 0; i < quads_n; i++)
+            if (materials[quads.mat[i]] && materials[quads.mat[i]]->is_emissive())
+                emitters.add_quad(load(quads.qx, quads.qy, quads.qz, i), load(quads.ux, quads.uy, quads.uz, i),
+                                  load(quads.vx, quads.vy, quads.vz, i), materials[quads.mat[i]].get());
+        bbox = bounds;
+        storage = owner;
+        return true;
+    }
+
+  private:
+    static const uint32_t type_shift = 30;
+    // The primitive type is stored in the two high bits of a reference
+    static const uint32_t slot_mask = (1u << type_shift) - 1;
+    // The index inside the type table is stored in the low bits
+
+    struct sphere_arrays {
+        table<double> cx, cy, cz;
+        table<double> radius;
+        table<uint32_t> mat;
+    };
+
+    struct moving_sphere_arrays {
+        table<double> cx, cy, cz;
+        // Center at time 0
+        table<double> dx, dy, dz;
+        // Motion between time 0 and time 1
+        table<double> radius;
+        table<uint32_t> mat;
+    };
+
+    struct quad_arrays {
+        table<double> qx, qy, qz;
+        // Corner
+        table<double> ux, uy, uz, vx, vy, vz;
+        // Edges
+        table<double> nx, ny, nz, d;
+        // Plane: unit normal and offset
+        table<double> wx, wy, wz;
+        // Cached n / (n.n) for the plane coordinates
+        table<uint32_t> mat;
+    };
+
+    sphere_arrays spheres;
+    // Stationary spheres
+    moving_sphere_arrays moving;
+    // Moving spheres
+    quad_arrays quads;
+    // Parallelograms (box sides included)
+    std::vector<shared_ptr<hittable>> objects;
+    // Custom hittables
+    std::vector<shared_ptr<material>> materials;
+    // Scene material table: owns the materials, primitives and hit records refer to them
+    light_list emitters;
+    // Stationary spheres and quads with an emissive material
+    table<uint32_t> refs;
+    // Primitive references: type in the high bits, index in the table of the type in the low bits
+    aabb bbox;
+    // Bounding box of every primitive
+    shared_ptr<const void> storage;
+    // Memory the tables are attached to, if any
+    std::vector<uint32_t> free_slots[4];
+    // Table slots of removed primitives, per type
+    bool lights_stale = false;
+    // An edit touched an emissive primitive or material since the lights were collected
+    bool bounds_stale = false;
+    // An edit removed or moved a primitive since the bounding box was computed
+
+    template <typename G, typename F>
+    static void visit_tables(G& g, F& f) {
+        f(g.spheres.cx); f(g.spheres.cy); f(g.spheres.cz); f(g.spheres.radius); f(g.spheres.mat);
+        f(g.moving.cx); f(g.moving.cy); f(g.moving.cz); f(g.moving.dx); f(g.moving.dy); f(g.moving.dz);
+        f(g.moving.radius); f(g.moving.mat);
+        f(g.quads.qx); f(g.quads.qy); f(g.quads.qz); f(g.quads.ux); f(g.quads.uy); f(g.quads.uz);
+        f(g.quads.vx); f(g.quads.vy); f(g.quads.vz); f(g.quads.nx); f(g.quads.ny); f(g.quads.nz);
+        f(g.quads.d); f(g.quads.wx); f(g.quads.wy); f(g.quads.wz); f(g.quads.mat);
+        f(g.refs);
+    }
+
+    void add_reference(primitive_type type, size_t slot) {
+        refs.push_back((static_cast<uint32_t>(type) << type_shift) | static_cast<uint32_t>(slot));
+        bbox = aabb(bbox, primitive_bounds(static_cast<uint32_t>(refs.size() - 1)));
+    }
+
+    point3 moving_center(uint32_t i, double time) const {
+        // Center of a moving sphere at the given time
+        return load(moving.cx, moving.cy, moving.cz, i) + time * load(moving.dx, moving.dy, moving.dz, i);
+    }
+
+    bool hit_quad(uint32_t i, const ray& r, const interval& ray_t, double& t, double& alpha, double& beta) const {
+        // Intersection with the parallelogram i of the quad table
+        if (!hit_quad_plane(load(quads.qx, quads.qy, quads.qz, i), load(quads.ux, quads.uy, quads.uz, i),
+                            load(quads.vx, quads.vy, quads.vz, i), load(quads.nx, quads.ny, quads.nz, i), quads.d[i],
+                            load(quads.wx, quads.wy, quads.wz, i), r, ray_t, t, alpha, beta))
+            return false;
+        return (alpha >= 0) && (alpha <= 1) && (beta >= 0) && (beta <= 1);
+    }
+
+    static point3 load(const table<double>& x, const table<double>& y, const table<double>& z, uint32_t i) {
+        return point3(x[i], y[i], z[i]);
+    }
+
+    bool is_emissive(uint32_t mat) const { return materials[mat] && materials[mat]->is_emissive(); }
+
+    uint32_t new_slot(primitive_type type, size_t table_size) {
+        // Slot of a new primitive: a freed one, or a new one at the end of the table
+        if (free_slots[type].empty())
+            return static_cast<uint32_t>(table_size);
+        uint32_t slot = free_slots[type].back();
+        free_slots[type].pop_back();
+        return slot;
+    }
+
+    template <typename T>
+    static void put(table<T>& column, uint32_t i, const T& value) {
+        // Write slot i of a column, growing it when i is the next slot
+        if (i == column.size())
+            column.push_back(value);
+        else
+            column[i] = value;
+    }
+
+    static void put(table<double>& x, table<double>& y, table<double>& z, uint32_t i, const vec3& value) {
+        put(x, i, value.x());
+        put(y, i, value.y());
+        put(z, i, value.z());
+    }
+
+    void write_sphere(uint32_t i, const point3& center, double radius, uint32_t mat) {
+        put(spheres.cx, spheres.cy, spheres.cz, i, center);
+        put(spheres.radius, i, radius);
+        put(spheres.mat, i, mat);
+    }
+
+    void write_moving_sphere(uint32_t i, const point3& center1, const point3& center2, double radius, uint32_t mat) {
+        put(moving.cx, moving.cy, moving.cz, i, center1);
+        put(moving.dx, moving.dy, moving.dz, i, center2 - center1);
+        put(moving.radius, i, radius);
+        put(moving.mat, i, mat);
+    }
+
+    void write_quad(uint32_t i, const point3& Q, const vec3& u, const vec3& v, uint32_t mat) {
+        vec3 n = cross(u, v);
+        vec3 normal = unit_vector(n);
+        put(quads.qx, quads.qy, quads.qz, i, Q);
+        put(quads.ux, quads.uy, quads.uz, i, u);
+        put(quads.vx, quads.vy, quads.vz, i, v);
+        put(quads.nx, quads.ny, quads.nz, i, normal);
+        put(quads.wx, quads.wy, quads.wz, i, n / dot(n, n));
+        put(quads.d, i, dot(normal, Q));
+        put(quads.mat, i, mat);
+    }
+};
+
+#endif
@@ -8,6 +8,76 @@
 #include "vec3.hpp"
 // Include the vec3 header file for point and vector representations
 
+inline void get_sphere_uv(const point3& p, double& u, double& v) {
+    // p: a given point on the sphere of radius one, centered at the origin.
+    // u: returned value [0,1] of angle around the Y axis from X=-1.
+    // v: returned value [0,1] of angle from Y=-1 to Y=+1.
+    //     <1 0 0> yields <0.50 0.50>       <-1  0  0> yields <0.00 0.50>
+    //     <0 1 0> yields <0.50 1.00>       < 0 -1  0> yields <0.50 0.00>
+    //     <0 0 1> yields <0.25 0.50>       < 0  0 -1> yields <0.75 0.50>
+
+    auto theta = acos(-p.y());
+    // Compute the polar angle theta
+    auto phi = atan2(-p.z(), p.x()) + pi;
+    // Compute the azimuthal angle phi
+
+    u = phi / (2*pi);
+    // Normalize phi to [0,1]
+    v = theta / pi;
+    // Normalize theta to [0,1]
+}
+
+inline bool hit_sphere_distance(const point3& center, double radius, const ray& r, const interval& ray_t, double& t) {
+    // Distance along the ray to the nearest intersection with a sphere inside ray_t
+    vec3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius*radius;
+
+    auto discriminant = half_b*half_b - a*c;
+
+    if (discriminant < 0) return false;
+    // If the discriminant is negative, the ray misses the sphere
+    auto sqrtd = sqrt(discriminant);
+
+    // Find the nearest root that lies in the acceptable range
+    auto root = (-half_b - sqrtd) / a;
+    if (!ray_t.surrounds(root)) {
+        root = (-half_b + sqrtd) / a;
+        // If the first root is outside the acceptable range, try the second root
+        if (!ray_t.surrounds(root))
+            return false;
+            // If both roots are outside the acceptable range, the ray misses the sphere
+    }
+
+    t = root;
+    return true;
+}
+
+inline void set_sphere_hit(const point3& center, double radius, const ray& r, double t, hit_record& rec) {
+    // Fill everything in rec but the material for a hit at distance t
+    rec.t = t;
+    // Set the parameter value of the intersection point
+    rec.p = r.at(rec.t);
+    // Set the point of intersection
+    vec3 outward_normal = (rec.p - center) / radius;
+    // Calculate the outward normal vector at the point of intersection
+    rec.set_face_normal(r, outward_normal);
+    // Set the normal vector at the point of intersection
+    get_sphere_uv(outward_normal, rec.u, rec.v);
+    // Compute the texture coordinates at the point of intersection
+}
+
+inline bool hit_sphere_surface(const point3& center, double radius, const ray& r, interval ray_t, hit_record& rec) {
+    // Intersect the ray with a sphere and fill everything in rec but the material.
+    // Shared by the sphere class and the sphere arrays of scene_geometry.
+    double t;
+    if (!hit_sphere_distance(center, radius, r, ray_t, t))
+        return false;
+    set_sphere_hit(center, radius, r, t, rec);
+    return true;
+}
+
 class sphere : public hittable {
 // Define a class representing a sphere as a hittable object
   public:
@@ -43,39 +113,10 @@ class sphere : public hittable {
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
         // Function to check if a ray intersects the sphere
         point3 center = is_moving ? sphere_center(r.time()) : center1;
-        vec3 oc = r.origin() - center;
-        auto a = r.direction().length_squared();
-        auto half_b = dot(oc, r.direction());
-        auto c = oc.length_squared() - radius*radius;
-
-        auto discriminant = half_b*half_b - a*c;
-
-        if (discriminant < 0) return false;
-        // If the discriminant is negative, the ray misses the sphere
-        auto sqrtd = sqrt(discriminant);
-
-        // Find the nearest root that lies in the acceptable range
-        auto root = (-half_b - sqrtd) / a;
-        if (!ray_t.surrounds(root)) {
-            root = (-half_b + sqrtd) / a;
-            // If the first root is outside the acceptable range, try the second root
-            if (!ray_t.surrounds(root))
-                return false;
-                // If both roots are outside the acceptable range, the ray misses the sphere
-        }
-
-        rec.t = root;
-        // Set the parameter value of the intersection point
-        rec.p = r.at(rec.t);
-        // Set the point of intersection
-        vec3 outward_normal = (rec.p - center) / radius;
-        // Calculate the outward normal vector at the point of intersection
-        rec.set_face_normal(r, outward_normal);
-        // Set the normal vector at the point of intersection
-        get_sphere_uv(outward_normal, rec.u, rec.v);
-        // Compute the texture coordinates at the point of intersection
-        rec.mat = mat;
-        // Set the material of the sphere
+        if (!hit_sphere_surface(center, radius, r, ray_t, rec))
+            return false;
+        rec.mat = mat.get();
+        // Set the material of the sphere (owned by the sphere, no reference count traffic)
 
         return true;
     }
@@ -102,25 +143,6 @@ class sphere : public hittable {
         // where t=0 yields center1, and t=1 yields center2.
         return center1 + time*center_vec;
     }
-
-    static void get_sphere_uv(const point3& p, double& u, double& v) {
-        // p: a given point on the sphere of radius one, centered at the origin.
-        // u: returned value [0,1] of angle around the Y axis from X=-1.
-        // v: returned value [0,1] of angle from Y=-1 to Y=+1.
-        //     <1 0 0> yields <0.50 0.50>       <-1  0  0> yields <0.00 0.50>
-        //     <0 1 0> yields <0.50 1.00>       < 0 -1  0> yields <0.50 0.00>
-        //     <0 0 1> yields <0.25 0.50>       < 0  0 -1> yields <0.75 0.50>
-
-        auto theta = acos(-p.y());
-        // Compute the polar angle theta
-        auto phi = atan2(-p.z(), p.x()) + pi;
-        // Compute the azimuthal angle phi
-
-        u = phi / (2*pi);
-        // Normalize phi to [0,1]
-        v = theta / pi;
-        // Normalize theta to [0,1]
-    }
 };
 
 #endif
\ No newline at end of file
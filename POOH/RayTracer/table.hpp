@@ -0,0 +1,101 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <cstddef>
+// Include the cstddef header file for size_t
+#include <vector>
+// Include the vector header file for the owned elements
+
+template <typename T>
+class table {
+    // Contiguous array of plain values, used like a std::vector. A table either owns its
+    // elements or, after attach, uses elements that live somewhere else (a memory mapped
+    // scene file) in place. Reading costs the same in both cases: a pointer and an index.
+    // Growing an attached table first copies its elements into memory of its own.
+  public:
+    table() = default;
+
+    table(const table& other) { *this = other; }
+
+    table(table&& other) noexcept { *this = std::move(other); }
+
+    table& operator=(const table& other) {
+        if (this == &other)
+            return *this;
+        owned = other.owned;
+        borrowed = other.borrowed;
+        if (borrowed) {
+            first = other.first;
+            count = other.count;
+        } else {
+            sync();
+        }
+        return *this;
+    }
+
+    table& operator=(table&& other) noexcept {
+        owned = std::move(other.owned);
+        borrowed = other.borrowed;
+        first = other.first;
+        count = other.count;
+        if (!borrowed)
+            sync();
+        other.owned.clear();
+        other.borrowed = false;
+        other.sync();
+        return *this;
+    }
+
+    void attach(T* elements, size_t size) {
+        // Use 'size' elements at 'elements' in place, they must outlive the table
+        owned = std::vector<T>();
+        borrowed = true;
+        first = elements;
+        count = size;
+    }
+
+    bool attached() const { return borrowed; }
+    // True while the elements live outside the table
+
+    void own() {
+        // Copy attached elements into memory of its own, e.g. before they are written to
+        if (!borrowed)
+            return;
+        owned.assign(first, first + count);
+        borrowed = false;
+        sync();
+    }
+
+    void push_back(const T& value) { own(); owned.push_back(value); sync(); }
+    void reserve(size_t size) { own(); owned.reserve(size); sync(); }
+    void resize(size_t size) { own(); owned.resize(size); sync(); }
+    void clear() { owned.clear(); borrowed = false; sync(); }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    T& operator[](size_t i) { return first[i]; }
+    const T& operator[](size_t i) const { return first[i]; }
+
+    T* data() { return first; }
+    const T* data() const { return first; }
+    T* begin() { return first; }
+    T* end() { return first + count; }
+    const T* begin() const { return first; }
+    const T* end() const { return first + count; }
+
+  private:
+    std::vector<T> owned;
+    // Elements of the table when it is not attached
+    bool borrowed = false;
+    T* first = nullptr;
+    size_t count = 0;
+    // Elements in use: owned.data() or the attached memory
+
+    void sync() {
+        first = owned.data();
+        count = owned.size();
+    }
+};
+
+#endif
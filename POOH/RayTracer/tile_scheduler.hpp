@@ -0,0 +1,159 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include <algorithm>
+// Include the algorithm header file for sorting the tiles
+#include <cmath>
+// Include the cmath header file for the spiral angle
+#include <cstdint>
+// Include the cstdint header file for fixed width Morton codes
+#include <deque>
+// Include the deque header file for the per-worker tile queues
+#include <memory>
+// Include the memory header file for unique_ptr
+#include <mutex>
+// Include the mutex header file to protect each worker queue
+#include <vector>
+// Include the vector header file for vector representation
+
+struct tile {
+    int x0, y0;
+    // Upper left pixel of the tile (inclusive)
+    int x1, y1;
+    // Lower right pixel of the tile (exclusive)
+};
+
+enum class tile_order {
+    scanline,
+    // Row after row, left to right
+    morton,
+    // Z-order curve, keeps neighbouring tiles close in time (better cache reuse)
+    spiral
+    // From the center of the image outwards, the interesting part shows up first
+};
+
+class tile_scheduler {
+    // Splits the image into tiles and hands them to the render threads.
+    // Every worker owns a deque: it pops tiles from its front and, once it runs dry,
+    // steals from the back of the other workers so no thread waits on a slow region.
+  public:
+    tile_scheduler(int image_width, int image_height, int tile_size, tile_order order, int num_workers)
+    {
+        tile_size = (tile_size < 1) ? 1 : tile_size;
+        num_workers = (num_workers < 1) ? 1 : num_workers;
+
+        int tiles_x = (image_width + tile_size - 1) / tile_size;
+        int tiles_y = (image_height + tile_size - 1) / tile_size;
+
+        struct keyed_tile {
+            uint64_t key;
+            double angle;
+            tile t;
+        };
+        std::vector<keyed_tile> keyed;
+        keyed.reserve(static_cast<size_t>(tiles_x) * tiles_y);
+
+        double cx = 0.5 * (tiles_x - 1);
+        double cy = 0.5 * (tiles_y - 1);
+
+        for (int ty = 0; ty < tiles_y; ++ty) {
+            for (int tx = 0; tx < tiles_x; ++tx) {
+                tile t;
+                t.x0 = tx * tile_size;
+                t.y0 = ty * tile_size;
+                t.x1 = std::min(t.x0 + tile_size, image_width);
+                t.y1 = std::min(t.y0 + tile_size, image_height);
+
+                keyed_tile k{0, 0.0, t};
+                if (order == tile_order::morton) {
+                    k.key = morton_code(static_cast<uint32_t>(tx), static_cast<uint32_t>(ty));
+                } else if (order == tile_order::spiral) {
+                    // Ring index around the center tile, then the angle inside the ring
+                    double dx = tx - cx, dy = ty - cy;
+                    k.key = static_cast<uint64_t>(std::max(std::fabs(dx), std::fabs(dy)) + 0.5);
+                    k.angle = std::atan2(dy, dx);
+                } else {
+                    k.key = static_cast<uint64_t>(ty) * tiles_x + tx;
+                }
+                keyed.push_back(k);
+            }
+        }
+
+        std::stable_sort(keyed.begin(), keyed.end(), [](const keyed_tile& a, const keyed_tile& b) {
+            return (a.key != b.key) ? a.key < b.key : a.angle < b.angle;
+        });
+
+        // Give every worker a contiguous run of the ordered tiles, so a worker walks
+        // through a compact region of the image before it has to steal.
+        queues.reserve(num_workers);
+        for (int w = 0; w < num_workers; ++w)
+            queues.push_back(std::make_unique<worker_queue>());
+
+        size_t count = keyed.size();
+        for (size_t n = 0; n < count; ++n) {
+            size_t w = n * num_workers / count;
+            queues[w]->tiles.push_back(keyed[n].t);
+        }
+        total = count;
+    }
+
+    bool next(int worker, tile& out) {
+        // Fetch the next tile for 'worker'. Returns false once every queue is empty.
+        int n = static_cast<int>(queues.size());
+        worker = worker % n;
+
+        {
+            worker_queue& own = *queues[worker];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.tiles.empty()) {
+                out = own.tiles.front();
+                own.tiles.pop_front();
+                return true;
+            }
+        }
+
+        // Own queue is empty: steal from the back of the other queues
+        for (int k = 1; k < n; ++k) {
+            worker_queue& victim = *queues[(worker + k) % n];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tiles.empty()) {
+                out = victim.tiles.back();
+                victim.tiles.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t tile_count() const { return total; }
+    // Total number of tiles in the image
+
+  private:
+    struct worker_queue {
+        std::mutex lock;
+        std::deque<tile> tiles;
+    };
+
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    // One queue per worker thread
+    size_t total = 0;
+    // Number of tiles the image was split into
+
+    static uint64_t spread_bits(uint32_t x) {
+        // Insert a zero bit between every bit of x
+        uint64_t v = x;
+        v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+        v = (v | (v << 8))  & 0x00FF00FF00FF00FFull;
+        v = (v | (v << 4))  & 0x0F0F0F0F0F0F0F0Full;
+        v = (v | (v << 2))  & 0x3333333333333333ull;
+        v = (v | (v << 1))  & 0x5555555555555555ull;
+        return v;
+    }
+
+    static uint64_t morton_code(uint32_t x, uint32_t y) {
+        // Interleave the bits of x and y into a Z-order index
+        return spread_bits(x) | (spread_bits(y) << 1);
+    }
+};
+
+#endif
@@ -89,6 +89,11 @@ public:
         // Returns a random vector with each component in the range [min,max)
         return vec3(random_double(min,max), random_double(min,max), random_double(min,max));
     }
+
+    static vec3 random(sampler& rng, double min, double max) {
+        // Returns a random vector with each component in the range [min,max), drawn from rng
+        return vec3(random_double(rng,min,max), random_double(rng,min,max), random_double(rng,min,max));
+    }
 };
 
 // 'point3' is just an alias for 'vec3', but useful for geometric clarity in the code
@@ -160,10 +165,10 @@ inline vec3 unit_vector(vec3 v) {
     return v / v.length();
 }
 
-inline vec3 random_in_unit_disk() {
+inline vec3 random_in_unit_disk(sampler& rng) {
 // Returns a random point in the unit disk
     while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
+        auto p = vec3(random_double(rng,-1,1), random_double(rng,-1,1), 0);
         // Generate a random point in the square [-1,1] x [-1,1] x {0}
         if (p.length_squared() < 1)
         // Check if the point is inside the unit disk
@@ -171,10 +176,10 @@ inline vec3 random_in_unit_disk() {
     }
 }
 
-inline vec3 random_in_unit_sphere() {
+inline vec3 random_in_unit_sphere(sampler& rng) {
 // Returns a random point in the unit sphere
     while (true) {
-        auto p = vec3::random(-1,1);
+        auto p = vec3::random(rng,-1,1);
         // Generate a random point in the cube [-1,1] x [-1,1] x [-1,1]
         if (p.length_squared() < 1)
         // Check if the point is inside the unit sphere
@@ -182,15 +187,15 @@ inline vec3 random_in_unit_sphere() {
     }
 }
 
-inline vec3 random_unit_vector() {
+inline vec3 random_unit_vector(sampler& rng) {
 // Returns a random unit vector
-    return unit_vector(random_in_unit_sphere());
+    return unit_vector(random_in_unit_sphere(rng));
     // Return a random point in the unit sphere, normalized to a unit vector
 }
 
-inline vec3 random_on_hemisphere(const vec3& normal) {
+inline vec3 random_on_hemisphere(const vec3& normal, sampler& rng) {
 // Returns a random point on the hemisphere with the given normal
-    vec3 on_unit_sphere = random_unit_vector();
+    vec3 on_unit_sphere = random_unit_vector(rng);
     // Generate a random point on the unit sphere
     if (dot(on_unit_sphere, normal) > 0.0) 
     // Check if the point is in the same hemisphere as the normal
@@ -199,7 +204,7 @@ inline vec3 random_on_hemisphere(const vec3& normal) {
         return -on_unit_sphere;
 }
 
-vec3 reflect(const vec3& v, const vec3& n) {
+inline vec3 reflect(const vec3& v, const vec3& n) {
 // Reflects the vector v around the normal n
     return v - 2*dot(v,n)*n;
     // The reflection of a vector v around a normal n is given by v - 2*dot(v,n)*n
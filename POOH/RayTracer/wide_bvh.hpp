@@ -0,0 +1,298 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "ray_tracing_common.hpp"
+// Include the ray_tracing_common header file for common ray tracing utilities
+
+#include "hittable.hpp"
+// Include the hittable header file for hittable object representation
+#include "hittable_list.hpp"
+// Include the hittable list header file
+#include "flat_bvh.hpp"
+// Include the flat BVH header file, the wide tree is collapsed from a binary one
+#include "ray_packet.hpp"
+// Include the ray packet header file for the SIMD feature macros
+#include "render_stats.hpp"
+// Include the render stats header file for the hot path counters
+
+#include <cstdint>
+// Include the cstdint header file for the fixed width node fields
+#include <vector>
+// Include the vector header file for the node array
+
+struct wide_bvh_node {
+    // Node with up to four children. The child boxes are stored as structure of arrays,
+    // so one ray is tested against the four of them with a single SSE sequence.
+    // Unused slots are marked with the wide_bvh::unused_slot child index.
+    alignas(16) float bmin_x[4];
+    float bmin_y[4];
+    float bmin_z[4];
+    float bmax_x[4];
+    float bmax_y[4];
+    float bmax_z[4];
+    // Bounding boxes of the four children
+    uint32_t child[4];
+    // Interior child: index of its node. Leaf child: first entry in the primitive order
+    uint32_t count[4];
+    // Number of primitives of a leaf child, 0 for an interior child or an unused slot
+};
+
+static_assert(sizeof(wide_bvh_node) == 128, "wide_bvh_node must stay two cache lines");
+
+class wide_bvh : public hittable {
+    // 4-ary Bounding Volume Hierarchy. It is built by collapsing a SAH flat_bvh: every
+    // wide node takes the children of up to three binary levels, always opening the
+    // child with the biggest surface. Incoherent rays (diffuse bounces) gain the most,
+    // since one step tests four boxes instead of one and the children are visited
+    // from the nearest to the farthest.
+  public:
+    wide_bvh(const hittable_list& list) : wide_bvh(flat_bvh(list)) {}
+
+    wide_bvh(shared_ptr<const scene_geometry> scene) : wide_bvh(flat_bvh(scene)) {}
+
+    wide_bvh(const flat_bvh& binary)
+      : geometry(binary.primitive_source()), prim_indices(binary.primitive_order()), bbox(binary.bounding_box())
+    {
+        prim_indices.own();
+        // The binary tree may be attached to a mapped file (a cached BVH) that goes away with it
+        const auto& bin_nodes = binary.node_array();
+        if (bin_nodes.empty())
+            return;
+
+        if (bin_nodes[0].is_leaf()) {
+            // Single leaf: wrap it in a root with one used slot
+            nodes.push_back(empty_node());
+            set_child(nodes[0], 0, bin_nodes[0], bin_nodes[0].left_first, bin_nodes[0].count);
+            return;
+        }
+
+        nodes.reserve(bin_nodes.size() / 2 + 1);
+        nodes.push_back(empty_node());
+        collapse(bin_nodes, 0, 0);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        // Function to check if a ray hits the hierarchy
+        if (nodes.empty())
+            return false;
+
+        lane_ray lr(r);
+
+        struct stack_entry { uint32_t node; float t_entry; };
+        stack_entry stack[max_stack];
+        // Deferred interior children together with their entry distance
+        int sp = 0;
+        stack[sp++] = { 0, static_cast<float>(ray_t.min) };
+
+        bool hit_anything = false;
+        uint32_t closest_prim = 0;
+        // Closest primitive so far, its hit record is only filled once the traversal is over
+
+        while (sp > 0) {
+            stack_entry e = stack[--sp];
+            if (e.t_entry > ray_t.max)
+                continue;
+            const wide_bvh_node& node = nodes[e.node];
+            RT_STAT(bvh_nodes_visited);
+
+            float t_entry[4];
+            int mask = test_children(node, lr, ray_t, t_entry) & used_slots(node);
+            if (mask == 0)
+                continue;
+
+            // Sort the children that were hit from the nearest to the farthest
+            int order[4];
+            int n = 0;
+            for (int c = 0; c < 4; c++) {
+                if (!(mask & (1 << c)))
+                    continue;
+                int k = n++;
+                while (k > 0 && t_entry[order[k - 1]] > t_entry[c]) {
+                    order[k] = order[k - 1];
+                    k--;
+                }
+                order[k] = c;
+            }
+
+            // Intersect the leaves right away (nearest first), push the interior children
+            // farthest first so the nearest one is popped next
+            for (int k = 0; k < n; k++) {
+                int c = order[k];
+                if (node.count[c] == 0 || t_entry[c] > ray_t.max)
+                    continue;
+                for (uint32_t p = 0; p < node.count[c]; p++) {
+                    double t;
+                    uint32_t prim = prim_indices[node.child[c] + p];
+                    if (geometry->intersect_primitive(prim, r, ray_t, t, rec)) {
+                        hit_anything = true;
+                        closest_prim = prim;
+                        ray_t.max = t;
+                    }
+                }
+            }
+            for (int k = n - 1; k >= 0; k--) {
+                int c = order[k];
+                if (node.count[c] == 0 && t_entry[c] <= ray_t.max)
+                    stack[sp++] = { node.child[c], t_entry[c] };
+            }
+        }
+
+        if (hit_anything)
+            geometry->finalize_hit(closest_prim, r, ray_t.max, rec);
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+    // Function to compute the bounding box of the hierarchy
+
+    size_t node_count() const { return nodes.size(); }
+    // Number of wide nodes
+
+  private:
+    static const uint32_t unused_slot = 0xFFFFFFFFu;
+    // Child index of the slots a node does not use
+    static const int max_stack = 3 * flat_bvh::max_depth + 1;
+    // Size of the traversal stack: a step pops one node and pushes at most four, and the
+    // wide tree is never deeper than the binary one it was collapsed from (valid_layout
+    // keeps that one within flat_bvh::max_depth, also when it comes from a file)
+
+    shared_ptr<const scene_geometry> geometry;
+    // Primitives of the hierarchy
+    table<uint32_t> prim_indices;
+    // Primitive indices, every leaf references a contiguous range
+    std::vector<wide_bvh_node> nodes;
+    // Wide nodes, the root is nodes[0]
+    aabb bbox;
+    // Axis-aligned bounding box of the whole hierarchy
+
+    struct lane_ray {
+        // Ray origin and inverse direction in single precision, once per ray
+        float ox, oy, oz;
+        float ix, iy, iz;
+
+        lane_ray(const ray& r) {
+            point3 o = r.origin();
+            vec3 d = r.direction();
+            ox = static_cast<float>(o.x());
+            oy = static_cast<float>(o.y());
+            oz = static_cast<float>(o.z());
+            ix = static_cast<float>(1.0 / d.x());
+            iy = static_cast<float>(1.0 / d.y());
+            iz = static_cast<float>(1.0 / d.z());
+        }
+    };
+
+    static int test_children(const wide_bvh_node& node, const lane_ray& lr, const interval& ray_t, float* t_entry) {
+        // Slab test of the ray against the four child boxes, returns a bit per child hit
+        // and the entry distance of every child
+        float t_min = static_cast<float>(ray_t.min);
+        float t_max = static_cast<float>(ray_t.max);
+#if RT_X86_SIMD
+        __m128 ox = _mm_set1_ps(lr.ox), oy = _mm_set1_ps(lr.oy), oz = _mm_set1_ps(lr.oz);
+        __m128 ix = _mm_set1_ps(lr.ix), iy = _mm_set1_ps(lr.iy), iz = _mm_set1_ps(lr.iz);
+
+        __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bmin_x), ox), ix);
+        __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bmax_x), ox), ix);
+        __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bmin_y), oy), iy);
+        __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bmax_y), oy), iy);
+        __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bmin_z), oz), iz);
+        __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bmax_z), oz), iz);
+
+        __m128 t_near = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+                                   _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_set1_ps(t_min)));
+        __m128 t_far = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+                                  _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(t_max)));
+        _mm_storeu_ps(t_entry, t_near);
+        return _mm_movemask_ps(_mm_cmple_ps(t_near, _mm_mul_ps(t_far, _mm_set1_ps(packet_slab_slack))));
+#else
+        int mask = 0;
+        for (int c = 0; c < 4; c++) {
+            float t0x = (node.bmin_x[c] - lr.ox) * lr.ix, t1x = (node.bmax_x[c] - lr.ox) * lr.ix;
+            float t0y = (node.bmin_y[c] - lr.oy) * lr.iy, t1y = (node.bmax_y[c] - lr.oy) * lr.iy;
+            float t0z = (node.bmin_z[c] - lr.oz) * lr.iz, t1z = (node.bmax_z[c] - lr.oz) * lr.iz;
+            float t_near = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), t_min));
+            float t_far = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), t_max));
+            t_entry[c] = t_near;
+            if (t_near <= t_far * packet_slab_slack)
+                mask |= 1 << c;
+        }
+        return mask;
+#endif
+    }
+
+    static int used_slots(const wide_bvh_node& node) {
+        // Bit mask of the slots holding a child
+        int mask = 0;
+        for (int c = 0; c < 4; c++)
+            if (node.child[c] != unused_slot)
+                mask |= 1 << c;
+        return mask;
+    }
+
+    static wide_bvh_node empty_node() {
+        // Node with four unused slots
+        wide_bvh_node n;
+        const float inf = std::numeric_limits<float>::infinity();
+        for (int c = 0; c < 4; c++) {
+            n.bmin_x[c] = n.bmin_y[c] = n.bmin_z[c] = inf;
+            n.bmax_x[c] = n.bmax_y[c] = n.bmax_z[c] = inf;
+            n.child[c] = unused_slot;
+            n.count[c] = 0;
+        }
+        return n;
+    }
+
+    static void set_child(wide_bvh_node& n, int slot, const flat_bvh_node& box, uint32_t child, uint32_t count) {
+        n.bmin_x[slot] = box.bmin[0];
+        n.bmin_y[slot] = box.bmin[1];
+        n.bmin_z[slot] = box.bmin[2];
+        n.bmax_x[slot] = box.bmax[0];
+        n.bmax_y[slot] = box.bmax[1];
+        n.bmax_z[slot] = box.bmax[2];
+        n.child[slot] = child;
+        n.count[slot] = count;
+    }
+
+    static float half_area(const flat_bvh_node& n) {
+        float dx = n.bmax[0] - n.bmin[0], dy = n.bmax[1] - n.bmin[1], dz = n.bmax[2] - n.bmin[2];
+        return dx * dy + dy * dz + dz * dx;
+    }
+
+    void collapse(const table<flat_bvh_node>& bin_nodes, uint32_t bin_index, uint32_t wide_index) {
+        // Fill nodes[wide_index] with up to four descendants of the interior binary node bin_index
+        uint32_t slots[4] = { bin_nodes[bin_index].left_first, bin_nodes[bin_index].left_first + 1, 0, 0 };
+        int used = 2;
+
+        while (used < 4) {
+            // Open the interior slot with the biggest surface
+            int best = -1;
+            float best_area = -1;
+            for (int s = 0; s < used; s++) {
+                const flat_bvh_node& n = bin_nodes[slots[s]];
+                if (!n.is_leaf() && half_area(n) > best_area) {
+                    best_area = half_area(n);
+                    best = s;
+                }
+            }
+            if (best < 0)
+                break;
+            uint32_t opened = slots[best];
+            slots[best] = bin_nodes[opened].left_first;
+            slots[used++] = bin_nodes[opened].left_first + 1;
+        }
+
+        for (int s = 0; s < used; s++) {
+            const flat_bvh_node& n = bin_nodes[slots[s]];
+            if (n.is_leaf()) {
+                set_child(nodes[wide_index], s, n, n.left_first, n.count);
+            } else {
+                uint32_t child_index = static_cast<uint32_t>(nodes.size());
+                nodes.push_back(empty_node());
+                set_child(nodes[wide_index], s, n, child_index, 0);
+                collapse(bin_nodes, slots[s], child_index);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include "distributed_render.h"
+
+#include <cstdio>
+#include <sstream>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+static const char* const pipeMode = "rb";
+#else
+static const char* const pipeMode = "r";
+#endif
+
+std::vector<WorkRange> splitFrame(int height, int samplesPerPixel, int workers, SplitMode mode) {
+    int total = (mode == SplitMode::Rows) ? height : samplesPerPixel;
+    if (workers > total)
+        workers = total;
+    std::vector<WorkRange> ranges;
+    for (int k = 0; k < workers; ++k) {
+        int begin = static_cast<int>(static_cast<long long>(total) * k / workers);
+        int end = static_cast<int>(static_cast<long long>(total) * (k + 1) / workers);
+        WorkRange range;
+        range.rowEnd = height;
+        range.sampleEnd = samplesPerPixel;
+        if (mode == SplitMode::Rows) {
+            range.rowBegin = begin;
+            range.rowEnd = end;
+        } else {
+            range.sampleBegin = begin;
+            range.sampleEnd = end;
+        }
+        ranges.push_back(range);
+    }
+    return ranges;
+}
+
+std::string quoteArgument(const std::string& argument) {
+#ifdef _WIN32
+    std::string quoted = "\"";
+    for (char c : argument) {
+        if (c == '"')
+            quoted += '\\';
+        quoted += c;
+    }
+    return quoted + "\"";
+#else
+    std::string quoted = "'";
+    for (char c : argument) {
+        if (c == '\'')
+            quoted += "'\\''";
+        else
+            quoted += c;
+    }
+    return quoted + "'";
+#endif
+}
+
+bool runWorkers(const std::vector<std::string>& commands, std::vector<RayTracing::PartialFrame>& parts,
+                std::string& error) {
+    // Start every worker first so they all render at the same time; a worker that finishes
+    // before its turn to be read just waits on its full pipe
+    std::vector<FILE*> pipes;
+    for (const std::string& command : commands) {
+        FILE* pipe = popen(command.c_str(), pipeMode);
+        if (!pipe)
+            error = "could not start: " + command;
+        pipes.push_back(pipe);
+    }
+
+    parts.assign(commands.size(), RayTracing::PartialFrame());
+    for (size_t k = 0; k < pipes.size(); ++k) {
+        if (!pipes[k])
+            continue;
+        std::string output;
+        char buffer[1 << 16];
+        size_t read;
+        while ((read = std::fread(buffer, 1, sizeof buffer, pipes[k])) > 0)
+            output.append(buffer, read);
+        int status = pclose(pipes[k]);
+
+        std::istringstream in(output);
+        if (status != 0)
+            error = "worker " + std::to_string(k) + " failed: " + commands[k];
+        else if (!RayTracing::readPartialFrame(in, parts[k]))
+            error = "worker " + std::to_string(k) + " sent no partial frame: " + commands[k];
+    }
+    return error.empty();
+}
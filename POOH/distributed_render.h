@@ -0,0 +1,38 @@
+#ifndef DISTRIBUTED_RENDER_H
+#define DISTRIBUTED_RENDER_H
+
+#include <string>
+#include <vector>
+#include "RayTracer/RayTracer.hpp"
+
+// One frame rendered by several worker processes. The coordinator cuts the frame into
+// ranges, starts one worker per range (render_cli with --rows/--samples and --partial -,
+// run locally or through a launcher such as ssh) and reads back the partial frames they
+// write to their standard output, to be added up with RayTracing::mergePartialFrames.
+
+enum class SplitMode {
+    Rows,     // Every worker renders a band of rows with all the samples
+    Samples   // Every worker renders the whole frame with a share of the sample indices
+};
+
+struct WorkRange {
+    int rowBegin = 0;
+    int rowEnd = 0;
+    int sampleBegin = 0;
+    int sampleEnd = 0;
+};
+
+// Splits a frame of 'height' rows and 'samplesPerPixel' samples into at most 'workers'
+// ranges as even as possible
+std::vector<WorkRange> splitFrame(int height, int samplesPerPixel, int workers, SplitMode mode);
+
+// Quotes an argument for the command line of the shell that runs the workers
+std::string quoteArgument(const std::string& argument);
+
+// Runs the commands at the same time, each one expected to write one partial frame to its
+// standard output, and reads the frames back in order. Returns false with a message in
+// 'error' if a worker could not be started, failed or wrote something else.
+bool runWorkers(const std::vector<std::string>& commands, std::vector<RayTracing::PartialFrame>& parts,
+                std::string& error);
+
+#endif // DISTRIBUTED_RENDER_H
@@ -0,0 +1,303 @@
+// Headless renderer: reads an XML scene and writes the rendered image, no window system needed.
+//
+//   render_cli --scene output.xml --out image.png [--width 300] [--height 0] [--spp 0]
+//              [--depth 0] [--threads 0] [--render-type 1] [--seed 0] [--hdr image.exr]
+//              [--tonemap clamp|reinhard|aces] [--exposure 0] [--gamma 2]
+//              [--checkpoint job.ckpt] [--checkpoint-interval 60] [--stats stats.json]
+//              [--bvh-cache dir]
+//   render_cli --input image.pfm --out image.png [--tonemap ...] [--exposure 0] [--gamma 2]
+//   render_cli --scene output.xml --convert scene.rtscene
+//
+// --spp and --depth default to the values of the render type (1 low, 2 medium, 3 high),
+// --height 0 keeps the 16:9 aspect ratio and --threads 0 uses every hardware thread.
+// An --out or --hdr name ending in .exr or .pfm keeps the linear radiance; --input
+// tonemaps a PFM written earlier again without rendering. With --checkpoint the samples are
+// saved every --checkpoint-interval seconds; running the same command again after a crash
+// or preemption resumes the render from the last checkpoint. --stats writes the time of each
+// phase and, in builds configured with -DRT_ENABLE_STATS=ON, the ray and BVH counters.
+// --convert writes the XML scene as a binary scene file (primitive tables and BVH ready to
+// be mapped in memory), which --scene then loads in place of the XML in milliseconds.
+// --bvh-cache keeps the BVH of every XML scene rendered in dir, keyed by a hash of its
+// primitives: rendering the same geometry again, from another camera or with other
+// materials, maps the saved BVH instead of building it.
+//
+// Distributed rendering of one frame:
+//
+//   render_cli --scene output.xml --out image.png --workers 4 [--split rows|samples]
+//              [--launch "ssh node{i} /opt/pooh/render_cli"] [other render options]
+//
+// The coordinator cuts the frame into bands of rows or ranges of sample indices, runs one
+// worker per range (this program by default, or the --launch command with {i} replaced by
+// the worker number) and merges the float sums they send back over their standard output.
+// Scene paths must be valid for the workers too. A worker is this program run with
+//
+//   render_cli --scene output.xml --rows 0:100 --samples 0:400 --partial <file|->
+//
+// which renders only those rows and sample indices and writes the partial frame ("-" is
+// the standard output) instead of an image.
+//
+// Animations (turntables and fly-throughs of an XML scene):
+//
+//   render_cli --scene output.xml --out frames/frame_{frame}.png --frames 120
+//              [--turntable 360] [--fly-to x,y,z] [--motion-blur 0|1] [--refit-limit 0.3]
+//              [other render options]
+//
+// renders the frames one after the other, {frame} in --out, --hdr, --stats and --checkpoint
+// replaced by the frame number. The objects turn --turntable degrees over the sequence about
+// the up vector of the camera through its look-at point, the camera flies to --fly-to, and
+// spheres with a Position2 go there over the sequence (--motion-blur 1 blurs each frame over
+// its own shutter interval). The first frame builds the BVH and the next ones refit it in
+// place; it is built again once the refits made it --refit-limit more expensive to trace.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "RayTracer/RayTracer.hpp"
+#include "distributed_render.h"
+#include "scene_loader.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " --scene <file.xml> --out <image.png> [--width N] [--height N]"
+              << " [--spp N] [--depth N] [--threads N] [--render-type 1|2|3] [--seed N] [--hdr <image.exr>]"
+              << " [--tonemap clamp|reinhard|aces] [--exposure N] [--gamma N]"
+              << " [--checkpoint <file>] [--checkpoint-interval seconds] [--stats <file.json>] [--bvh-cache <dir>]\n"
+              << "       " << program << " --input <image.pfm> --out <image.png> [--tonemap ...] [--exposure N] [--gamma N]\n"
+              << "       " << program << " --scene <file.xml> --convert <file.rtscene>\n"
+              << "       " << program << " --scene <file.xml> --out <image.png> --workers N [--split rows|samples]"
+              << " [--launch <command>] [...]\n"
+              << "       " << program << " --scene <file.xml> --partial <file|-> [--rows A:B] [--samples A:B] [...]\n"
+              << "       " << program << " --scene <file.xml> --out <frame_{frame}.png> --frames N [--turntable degrees]"
+              << " [--fly-to x,y,z] [--motion-blur 0|1] [--refit-limit N] [...]\n";
+}
+
+// Parses "A:B" into a range
+static bool parseRange(const char* value, int& begin, int& end) {
+    return std::sscanf(value, "%d:%d", &begin, &end) == 2 && begin >= 0 && end >= begin;
+}
+
+// Renders the frame with several worker processes and writes the merged image
+static int renderDistributed(int argc, char** argv, const RayTracing::RenderOptions& options, int renderType,
+                             int workers, SplitMode split, const std::string& launch) {
+    // Options the workers need to trace the same frame, passed on as given
+    std::string common;
+    bool threadsGiven = false;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--scene" || arg == "--width" || arg == "--height" || arg == "--spp" || arg == "--depth" ||
+            arg == "--threads" || arg == "--render-type" || arg == "--seed" || arg == "--bvh-cache")
+            common += " " + arg + " " + quoteArgument(argv[i + 1]);
+        threadsGiven = threadsGiven || arg == "--threads";
+    }
+    if (launch.empty() && !threadsGiven) {
+        // Local workers share the cores of this machine
+        unsigned cores = std::thread::hardware_concurrency();
+        common += " --threads " + std::to_string((cores > static_cast<unsigned>(workers)) ? cores / workers : 1);
+    }
+
+    int height = RayTracing::imageHeight(options);
+    int samples = RayTracing::samplesPerPixel(renderType, options);
+    std::vector<WorkRange> ranges = splitFrame(height, samples, workers, split);
+
+    std::vector<std::string> commands;
+    for (size_t k = 0; k < ranges.size(); ++k) {
+        std::string program = launch.empty() ? quoteArgument(argv[0]) : launch;
+        size_t mark;
+        while ((mark = program.find("{i}")) != std::string::npos)
+            program.replace(mark, 3, std::to_string(k));
+        const WorkRange& r = ranges[k];
+        commands.push_back(program + common +
+                           " --rows " + std::to_string(r.rowBegin) + ":" + std::to_string(r.rowEnd) +
+                           " --samples " + std::to_string(r.sampleBegin) + ":" + std::to_string(r.sampleEnd) +
+                           " --partial -");
+    }
+
+    std::vector<RayTracing::PartialFrame> parts;
+    std::string error;
+    if (!runWorkers(commands, parts, error)) {
+        std::cerr << error << "\n";
+        return 1;
+    }
+
+    RayTracing::HdrImage image;
+    if (!RayTracing::mergePartialFrames(parts, image)) {
+        std::cerr << "The partial frames of the workers do not make up the frame\n";
+        return 1;
+    }
+    bool written = RayTracing::writeImage(image, options.outputPath, options);
+    if (written && !options.hdrOutputPath.empty())
+        written = RayTracing::writeImage(image, options.hdrOutputPath, options);
+    if (!written) {
+        std::cerr << "Could not write " << options.outputPath << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    std::string scenePath;
+    std::string inputPath;
+    std::string convertPath;
+    int renderType = 1;
+    RayTracing::RenderOptions options;
+    std::string partialPath;
+    RayTracing::PartialFrame partial;
+    int workers = 0;
+    SplitMode split = SplitMode::Rows;
+    std::string launch;
+    RayTracing::Animation animation;
+    animation.frames = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << "\n";
+            printUsage(argv[0]);
+            return 1;
+        }
+        const char* value = argv[++i];
+        if (arg == "--scene") scenePath = value;
+        else if (arg == "--input") inputPath = value;
+        else if (arg == "--convert") convertPath = value;
+        else if (arg == "--out") options.outputPath = value;
+        else if (arg == "--width") options.imageWidth = std::atoi(value);
+        else if (arg == "--height") options.imageHeight = std::atoi(value);
+        else if (arg == "--spp") options.samplesPerPixel = std::atoi(value);
+        else if (arg == "--depth") options.maxDepth = std::atoi(value);
+        else if (arg == "--threads") options.numThreads = std::atoi(value);
+        else if (arg == "--render-type") renderType = std::atoi(value);
+        else if (arg == "--seed") options.seed = std::strtoull(value, nullptr, 10);
+        else if (arg == "--hdr") options.hdrOutputPath = value;
+        else if (arg == "--exposure") options.exposure = std::atof(value);
+        else if (arg == "--gamma") options.gamma = std::atof(value);
+        else if (arg == "--checkpoint") options.checkpointPath = value;
+        else if (arg == "--checkpoint-interval") options.checkpointInterval = std::atof(value);
+        else if (arg == "--stats") options.statsPath = value;
+        else if (arg == "--bvh-cache") options.bvhCacheDir = value;
+        else if (arg == "--partial") partialPath = value;
+        else if (arg == "--rows" && parseRange(value, partial.rowBegin, partial.rowEnd)) {}
+        else if (arg == "--samples" && parseRange(value, partial.sampleBegin, partial.sampleEnd)) {}
+        else if (arg == "--workers") workers = std::atoi(value);
+        else if (arg == "--split" && std::strcmp(value, "rows") == 0) split = SplitMode::Rows;
+        else if (arg == "--split" && std::strcmp(value, "samples") == 0) split = SplitMode::Samples;
+        else if (arg == "--launch") launch = value;
+        else if (arg == "--frames") animation.frames = std::atoi(value);
+        else if (arg == "--turntable") animation.turntableDegrees = std::atof(value);
+        else if (arg == "--fly-to") {
+            animation.flyTo.assign(3, 0.0);
+            if (std::sscanf(value, "%lf,%lf,%lf", &animation.flyTo[0], &animation.flyTo[1], &animation.flyTo[2]) != 3) {
+                std::cerr << "Invalid value for --fly-to, expected x,y,z\n";
+                return 1;
+            }
+        }
+        else if (arg == "--motion-blur") animation.motionBlur = std::atoi(value) != 0;
+        else if (arg == "--refit-limit") options.refitCostLimit = std::atof(value);
+        else if (arg == "--tonemap" && std::strcmp(value, "clamp") == 0) options.tonemap = RayTracing::Tonemap::Clamp;
+        else if (arg == "--tonemap" && std::strcmp(value, "reinhard") == 0) options.tonemap = RayTracing::Tonemap::Reinhard;
+        else if (arg == "--tonemap" && std::strcmp(value, "aces") == 0) options.tonemap = RayTracing::Tonemap::Aces;
+        else {
+            std::cerr << "Unknown option " << arg << "\n";
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!inputPath.empty() && !options.outputPath.empty()) {
+        RayTracing::HdrImage image;
+        if (!RayTracing::readPfm(inputPath, image)) {
+            std::cerr << "Could not read " << inputPath << "\n";
+            return 1;
+        }
+        if (!RayTracing::writeImage(image, options.outputPath, options)) {
+            std::cerr << "Could not write " << options.outputPath << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!scenePath.empty() && !convertPath.empty()) {
+        scene_description scene;
+        if (!loadScene(scenePath, scene)) {
+            std::cerr << "Could not read a camera from " << scenePath << "\n";
+            return 1;
+        }
+        if (!RayTracing::writeSceneFile(scene, convertPath)) {
+            std::cerr << "Could not write " << convertPath << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (scenePath.empty() || (options.outputPath.empty() && partialPath.empty()) || options.imageWidth <= 0 ||
+        renderType < 1 || renderType > 3) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (animation.frames > 0) {
+        scene_description scene;
+        if (!partialPath.empty() || workers > 0 || RayTracing::isSceneFile(scenePath)) {
+            std::cerr << "Animations are rendered locally from an XML scene\n";
+            return 1;
+        }
+        if (!loadScene(scenePath, scene) || scene.cameras.empty()) {
+            std::cerr << "Could not read a camera from " << scenePath << "\n";
+            return 1;
+        }
+        RayTracing::AnimationReport report = RayTracing::renderAnimation(scene, animation, renderType, options);
+        std::cout << "Rendered " << report.frames << " frames of " << scenePath << " in "
+                  << report.updateSeconds + report.renderSeconds << " s (scene updates " << report.updateSeconds
+                  << " s, " << report.bvhRefits << " BVH refits, " << report.bvhRebuilds << " rebuilds)\n";
+        return (report.frames == animation.frames) ? 0 : 1;
+    }
+
+    if (workers > 0 && partialPath.empty())
+        return renderDistributed(argc, argv, options, renderType, workers, split, launch);
+
+    if (!partialPath.empty())
+        options.partial = &partial;
+
+    auto start = std::chrono::steady_clock::now();
+    scene_description scene;
+    std::shared_ptr<const RayTracing::PreparedScene> prepared;
+    if (RayTracing::isSceneFile(scenePath))
+        prepared = RayTracing::openSceneFile(scenePath, scene.cameras, options);
+    else if (loadScene(scenePath, scene))
+        prepared = RayTracing::prepareScene(scene, options);
+    if (!prepared || scene.cameras.empty()) {
+        std::cerr << "Could not read a camera from " << scenePath << "\n";
+        return 1;
+    }
+
+    RayTracing::renderPreparedScene(*prepared, scene.cameras[0], renderType, options);
+    auto end = std::chrono::steady_clock::now();
+
+    if (!partialPath.empty()) {
+        if (partialPath == "-") {
+#ifdef _WIN32
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            return RayTracing::writePartialFrame(std::cout, partial) ? 0 : 1;
+        }
+        std::ofstream file(partialPath, std::ios::binary);
+        if (!RayTracing::writePartialFrame(file, partial)) {
+            std::cerr << "Could not write " << partialPath << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    std::cout << "Rendered " << scenePath << " to " << options.outputPath << " in "
+              << std::chrono::duration<double>(end - start).count() << " s\n";
+    return 0;
+}
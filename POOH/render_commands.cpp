@@ -0,0 +1,24 @@
+#include "render_commands.h"
+
+void RenderCommandQueue::push(const RenderCommand& command) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        commands.push_back(command);
+        if (command.type == RenderCommandType::Cancel) {
+            *cancelRequested = true;
+        } else if (command.type == RenderCommandType::Render) {
+            if (*cancelRequested)
+                cancelRequested = std::make_shared<std::atomic<bool>>(false);
+            commands.back().cancel = cancelRequested;
+        }
+    }
+    ready.notify_one();
+}
+
+RenderCommand RenderCommandQueue::pop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    ready.wait(lock, [this] { return !commands.empty(); });
+    RenderCommand command = commands.front();
+    commands.pop_front();
+    return command;
+}
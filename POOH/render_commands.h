@@ -0,0 +1,43 @@
+#ifndef RENDER_COMMANDS_H
+#define RENDER_COMMANDS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+enum class RenderCommandType {
+    LoadScene,  // Read the scene file
+    Render,     // Render the loaded scene
+    Cancel,     // Stop the render in progress
+    Quit        // Leave the backend loop
+};
+
+struct RenderCommand {
+    RenderCommandType type;
+    int renderType = 0;   // Render: 1 low, 2 medium, 3 high
+    std::string path;     // LoadScene: scene file
+    std::shared_ptr<const std::atomic<bool>> cancel;  // Render: raised by a Cancel pushed after it (set by push)
+};
+
+// Commands sent by the user interface to the render backend. The backend sleeps in pop()
+// until a command arrives, so nothing spins while idle. Cancel is also raised right away on
+// the atomic flag of every Render pushed before it, since the backend is busy inside the
+// render it has to stop. A Render pushed after a Cancel gets a new flag, so a Cancel pressed
+// before the backend picks up the Render still stops it and an old Cancel never does.
+class RenderCommandQueue {
+public:
+    void push(const RenderCommand& command);
+    RenderCommand pop();
+
+private:
+    std::deque<RenderCommand> commands;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::shared_ptr<std::atomic<bool>> cancelRequested = std::make_shared<std::atomic<bool>>(false);
+    // Flag handed to the Render commands pushed since the last Cancel
+};
+
+#endif // RENDER_COMMANDS_H
@@ -0,0 +1,305 @@
+// Long-lived render service speaking a line protocol on stdin/stdout.
+//
+// Scenes are parsed and their BVH built once, then kept in memory: every render job only
+// sets up a camera. Jobs wait in a priority queue and run on a fixed pool of job workers,
+// each render using the tile scheduler threads of the ray tracer.
+//
+// Requests (one per line, values never contain spaces):
+//   load <scene> <file.xml>          parse and build a scene, cache it under <scene>
+//   load <scene> <file.rtscene>      map a binary scene file (render_cli --convert) instead
+//   unload <scene>                   drop a cached scene (running jobs keep their copy)
+//   render <job> <scene> [key=value ...]
+//        out=<image.png>  priority=<n> (higher first)  width= height= spp= depth=
+//        render_type=1|2|3  threads=  seed=  lights=0|1  vfov=
+//        lookfrom=x,y,z  lookat=x,y,z  vup=x,y,z  background=r,g,b
+//        hdr=<image.exr|.pfm>  tonemap=clamp|reinhard|aces  exposure=  gamma=
+//        checkpoint=<file>  (saved every 60 s, a job sent again resumes from it)
+//        stats=<file.json>  (phase times, and counters in RT_ENABLE_STATS builds)
+//        (camera values default to the ones of the scene file)
+//   cancel <job>                     remove a job that has not started yet
+//   quit                             finish the queued jobs and exit
+//
+// Replies (one per line): "ok ...", "queued <job>", "started <job>",
+// "done <job> <image.png> <seconds>", "cancelled <job>" and "error <what> <message>".
+//
+//   render_server [--workers N] [--bvh-cache dir]
+//                                    N jobs rendered at the same time (default 1); loads
+//                                    reuse the BVHs saved in dir by earlier loads or runs
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "RayTracer/RayTracer.hpp"
+#include "scene_loader.h"
+
+struct CachedScene {
+    scene_description description;
+    // Parsed scene file, its first camera gives the defaults of the jobs
+    std::shared_ptr<const RayTracing::PreparedScene> prepared;
+    // Geometry and BVH, shared by every job of the scene
+};
+
+struct RenderJob {
+    std::string id;
+    int priority = 0;
+    unsigned long long sequence = 0;
+    // Arrival order, breaks priority ties
+    std::shared_ptr<const CachedScene> scene;
+    int renderType = 1;
+    camera_description camera;
+    RayTracing::RenderOptions options;
+};
+
+struct JobOrder {
+    bool operator()(const RenderJob& a, const RenderJob& b) const {
+        if (a.priority != b.priority) return a.priority < b.priority;
+        return a.sequence > b.sequence;
+    }
+};
+
+class RenderServer {
+public:
+    RenderServer(int workers, const std::string& bvhCacheDir) {
+        loadOptions.bvhCacheDir = bvhCacheDir;
+        for (int i = 0; i < workers; ++i)
+            pool.emplace_back(&RenderServer::workerLoop, this);
+    }
+
+    ~RenderServer() {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueReady.notify_all();
+        for (auto& worker : pool)
+            worker.join();
+    }
+
+    bool handle(const std::string& line) {
+        // Runs one request, returns false on quit
+        std::istringstream in(line);
+        std::string command;
+        if (!(in >> command))
+            return true;
+
+        if (command == "quit")
+            return false;
+        if (command == "load") {
+            std::string name, path;
+            in >> name >> path;
+            load(name, path);
+        } else if (command == "unload") {
+            std::string name;
+            in >> name;
+            std::lock_guard<std::mutex> lock(sceneMutex);
+            reply(scenes.erase(name) ? "ok unloaded " + name : "error " + name + " unknown scene");
+        } else if (command == "render") {
+            enqueue(in);
+        } else if (command == "cancel") {
+            std::string id;
+            in >> id;
+            std::lock_guard<std::mutex> lock(queueMutex);
+            if (queuedIds.count(id)) {
+                cancelledIds.insert(id);
+                reply("cancelled " + id);
+            } else {
+                reply("error " + id + " not queued");
+            }
+        } else {
+            reply("error " + command + " unknown request");
+        }
+        return true;
+    }
+
+private:
+    std::map<std::string, std::shared_ptr<const CachedScene>> scenes;
+    std::mutex sceneMutex;
+    RayTracing::RenderOptions loadOptions;
+    // Options scenes are prepared with (the BVH cache directory)
+
+    std::priority_queue<RenderJob, std::vector<RenderJob>, JobOrder> queue;
+    std::set<std::string> queuedIds;
+    std::set<std::string> cancelledIds;
+    unsigned long long nextSequence = 0;
+    bool stopping = false;
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+
+    std::mutex outputMutex;
+    std::vector<std::thread> pool;
+
+    void reply(const std::string& message) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cout << message << std::endl;
+    }
+
+    void load(const std::string& name, const std::string& path) {
+        if (name.empty() || path.empty()) {
+            reply("error load expects <scene> <file.xml|file.rtscene>");
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        auto scene = std::make_shared<CachedScene>();
+        if (RayTracing::isSceneFile(path))
+            scene->prepared = RayTracing::openSceneFile(path, scene->description.cameras, loadOptions);
+        else if (loadScene(path, scene->description))
+            scene->prepared = RayTracing::prepareScene(scene->description, loadOptions);
+        if (!scene->prepared || scene->description.cameras.empty()) {
+            reply("error " + name + " could not read " + path);
+            return;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        {
+            std::lock_guard<std::mutex> lock(sceneMutex);
+            scenes[name] = scene;
+        }
+        reply("ok loaded " + name + " " + std::to_string(RayTracing::primitiveCount(*scene->prepared)) +
+              " primitives " + std::to_string(seconds) + " s");
+    }
+
+    static bool parseVector(const std::string& value, vec3& out) {
+        std::vector<double> v = parseDoubleArray(value);
+        if (v.size() != 3)
+            return false;
+        out = vec3(v[0], v[1], v[2]);
+        return true;
+    }
+
+    void enqueue(std::istringstream& in) {
+        RenderJob job;
+        std::string sceneName;
+        in >> job.id >> sceneName;
+        if (job.id.empty() || sceneName.empty()) {
+            reply("error render expects <job> <scene>");
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(sceneMutex);
+            auto it = scenes.find(sceneName);
+            if (it == scenes.end()) {
+                reply("error " + job.id + " unknown scene " + sceneName);
+                return;
+            }
+            job.scene = it->second;
+        }
+
+        job.camera = job.scene->description.cameras[0];
+        job.options.outputPath = job.id + ".png";
+
+        std::string pair;
+        while (in >> pair) {
+            size_t eq = pair.find('=');
+            std::string key = pair.substr(0, eq);
+            std::string value = (eq == std::string::npos) ? "" : pair.substr(eq + 1);
+            bool ok = true;
+            try {
+                if (key == "out") job.options.outputPath = value;
+                else if (key == "priority") job.priority = std::stoi(value);
+                else if (key == "width") job.options.imageWidth = std::stoi(value);
+                else if (key == "height") job.options.imageHeight = std::stoi(value);
+                else if (key == "spp") job.options.samplesPerPixel = std::stoi(value);
+                else if (key == "depth") job.options.maxDepth = std::stoi(value);
+                else if (key == "render_type") job.renderType = std::stoi(value);
+                else if (key == "threads") job.options.numThreads = std::stoi(value);
+                else if (key == "seed") job.options.seed = std::stoull(value);
+                else if (key == "lights") job.options.sampleLights = std::stoi(value) != 0;
+                else if (key == "hdr") job.options.hdrOutputPath = value;
+                else if (key == "checkpoint") job.options.checkpointPath = value;
+                else if (key == "stats") job.options.statsPath = value;
+                else if (key == "exposure") job.options.exposure = std::stod(value);
+                else if (key == "gamma") job.options.gamma = std::stod(value);
+                else if (key == "tonemap" && value == "clamp") job.options.tonemap = RayTracing::Tonemap::Clamp;
+                else if (key == "tonemap" && value == "reinhard") job.options.tonemap = RayTracing::Tonemap::Reinhard;
+                else if (key == "tonemap" && value == "aces") job.options.tonemap = RayTracing::Tonemap::Aces;
+                else if (key == "vfov") job.camera.vfov = std::stod(value);
+                else if (key == "lookfrom") ok = parseVector(value, job.camera.lookfrom);
+                else if (key == "lookat") ok = parseVector(value, job.camera.lookat);
+                else if (key == "vup") ok = parseVector(value, job.camera.vup);
+                else if (key == "background") ok = parseVector(value, job.camera.background);
+                else ok = false;
+            } catch (const std::exception&) {
+                ok = false;
+            }
+            if (!ok) {
+                reply("error " + job.id + " bad parameter " + pair);
+                return;
+            }
+        }
+        if (job.options.imageWidth <= 0 || job.renderType < 1 || job.renderType > 3) {
+            reply("error " + job.id + " bad image size or render type");
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            if (queuedIds.count(job.id)) {
+                reply("error " + job.id + " already queued");
+                return;
+            }
+            job.sequence = nextSequence++;
+            queuedIds.insert(job.id);
+            reply("queued " + job.id);
+            queue.push(std::move(job));
+        }
+        queueReady.notify_one();
+    }
+
+    void workerLoop() {
+        while (true) {
+            RenderJob job;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueReady.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                job = queue.top();
+                queue.pop();
+                queuedIds.erase(job.id);
+                if (cancelledIds.erase(job.id))
+                    continue;
+            }
+
+            reply("started " + job.id);
+            auto start = std::chrono::steady_clock::now();
+            RayTracing::renderPreparedScene(*job.scene->prepared, job.camera, job.renderType, job.options);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            reply("done " + job.id + " " + job.options.outputPath + " " + std::to_string(seconds));
+        }
+    }
+};
+
+int main(int argc, char** argv) {
+    int workers = 1;
+    std::string bvhCacheDir;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--workers" && i + 1 < argc) {
+            workers = std::atoi(argv[++i]);
+        } else if (arg == "--bvh-cache" && i + 1 < argc) {
+            bvhCacheDir = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--workers N] [--bvh-cache dir]\n";
+            return 1;
+        }
+    }
+    if (workers < 1)
+        workers = 1;
+
+    RenderServer server(workers, bvhCacheDir);
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (!server.handle(line))
+            break;
+    }
+    return 0;
+}
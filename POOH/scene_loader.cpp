@@ -0,0 +1,26 @@
+#include <cctype>
+#include <charconv>
+#include "scene_loader.h"
+#include "xml_reader.h"
+
+std::vector<double> parseDoubleArray(const std::string& str) {
+    std::vector<double> result;
+    const char* text = str.data();
+    const char* end = text + str.size();
+    while (true) {
+        while (text < end && (*text == '[' || *text == ']' || *text == ',' || std::isspace(static_cast<unsigned char>(*text))))
+            ++text;
+        double value;
+        auto parsed = std::from_chars(text, end, value);
+        if (text == end || parsed.ec != std::errc())
+            break;
+        result.push_back(value);
+        text = parsed.ptr;
+    }
+    return result;
+}
+
+bool loadScene(const std::string& fileName, scene_description& scene) {
+    XMLReader xmlReader(fileName);
+    return xmlReader.read(scene) && !scene.cameras.empty();
+}
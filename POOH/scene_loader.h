@@ -0,0 +1,15 @@
+#ifndef SCENE_LOADER_H
+#define SCENE_LOADER_H
+
+#include <string>
+#include <vector>
+#include "RayTracer/scene_description.hpp"
+
+// Parses "[a, b, c]" into {a, b, c}
+std::vector<double> parseDoubleArray(const std::string& str);
+
+// Reads the cameras, materials and objects of an XML scene file in a single pass, returns
+// false if the file could not be read or has no camera
+bool loadScene(const std::string& fileName, scene_description& scene);
+
+#endif // SCENE_LOADER_H
@@ -1,104 +1,149 @@
 #include "pugixml.hpp"
+#include <cctype>
+#include <charconv>
+#include <cstring>
 #include <iostream>
-#include <vector>
 #include "xml_reader.h"
 
 XMLReader::XMLReader(const std::string& fileName) : fileName_(fileName) {}
 
+// Lee hasta 'count' números de un texto como "[a, b, c]", devuelve cuántos leyó
+static int parseNumbers(const char* text, double* values, int count) {
+    const char* end = text + std::strlen(text);
+    int n = 0;
+    while (n < count) {
+        while (text < end && (*text == '[' || *text == ']' || *text == ',' || std::isspace(static_cast<unsigned char>(*text))))
+            ++text;
+        if (text == end)
+            break;
+        auto result = std::from_chars(text, end, values[n]);
+        if (result.ec != std::errc())
+            break;
+        text = result.ptr;
+        ++n;
+    }
+    return n;
+}
 
-SceneInfo XMLReader::readSceneInfo() {
-    SceneInfo sceneInfo;
+// Vector de tres componentes (las que falten quedan en 0)
+static vec3 parseVec3(const char* text) {
+    double v[3] = {0, 0, 0};
+    parseNumbers(text, v, 3);
+    return vec3(v[0], v[1], v[2]);
+}
 
-    pugi::xml_document doc;
-    pugi::xml_parse_result result = doc.load_file(fileName_.c_str());
-    if (!result) {
-        std::cerr << "Error al cargar el archivo XML. Detalles: " << result.description() << std::endl;
-        return sceneInfo;
+static bool readCamera(pugi::xml_node cameraNode, camera_description& camera) {
+    for (pugi::xml_node field = cameraNode.first_child(); field; field = field.next_sibling()) {
+        const char* name = field.name();
+        const char* value = field.child_value();
+        if (std::strcmp(name, "look_from") == 0)
+            camera.lookfrom = parseVec3(value);
+        else if (std::strcmp(name, "look_at") == 0)
+            camera.lookat = parseVec3(value);
+        else if (std::strcmp(name, "vup") == 0)
+            camera.vup = parseVec3(value);
+        else if (std::strcmp(name, "background_color") == 0)
+            camera.background = parseVec3(value);
+        else if (std::strcmp(name, "vfov") == 0 && parseNumbers(value, &camera.vfov, 1) != 1) {
+            std::cerr << "Invalid argument: Unable to convert vfov to double" << std::endl;
+            return false;
+        }
     }
+    return true;
+}
 
-    pugi::xml_node sceneNode = doc.child("scene");
-    if (sceneNode) {
-        pugi::xml_node cameraNode = sceneNode.child("camara");
-        if (cameraNode) {
-            CameraInfo cameraInfo;
-            cameraInfo.lookFrom = cameraNode.child_value("look_from");
-            cameraInfo.lookAt = cameraNode.child_value("look_at");
-            cameraInfo.vup = cameraNode.child_value("vup");
-            cameraInfo.vfov = std::stod(cameraNode.child_value("vfov"));
-            cameraInfo.backgroundColor = cameraNode.child_value("background_color");
-
-            try {
-                cameraInfo.vfov = std::stod(cameraNode.child_value("vfov"));
-            } catch (std::invalid_argument&) {
-                std::cerr << "Invalid argument: Unable to convert vfov to double 1  : " << std::endl;
-            }
+// Convierte un <object> en un material y una primitiva, devuelve false si la forma o el material no se conocen
+static bool readObject(pugi::xml_node objectNode, material_description& material, primitive_description& primitive) {
+    const char* shape = "";
+    const char* materialName = "";
+    double colors[4] = {0, 0, 0, 0};
+    double colors2[3] = {0, 0, 0};
+    bool hasColors2 = false;
+    bool hasPosition2 = false;
+    point3 position, position2, origen, point1, point2;
+    vec3 vect1, vect2;
+
+    // Un solo recorrido de los hijos del objeto, en el orden en que aparezcan
+    for (pugi::xml_node field = objectNode.first_child(); field; field = field.next_sibling()) {
+        const char* name = field.name();
+        const char* value = field.child_value();
+        if (std::strcmp(name, "Shape_type") == 0) shape = value;
+        else if (std::strcmp(name, "Material") == 0) materialName = value;
+        else if (std::strcmp(name, "Colors") == 0) parseNumbers(value, colors, 4);
+        else if (std::strcmp(name, "Colors2") == 0) hasColors2 = parseNumbers(value, colors2, 3) > 0;
+        else if (std::strcmp(name, "Position") == 0) position = parseVec3(value);
+        else if (std::strcmp(name, "Position2") == 0) { position2 = parseVec3(value); hasPosition2 = true; }
+        else if (std::strcmp(name, "Ratio") == 0) parseNumbers(value, &primitive.radius, 1);
+        else if (std::strcmp(name, "Origen") == 0) origen = parseVec3(value);
+        else if (std::strcmp(name, "Vector1") == 0) vect1 = parseVec3(value);
+        else if (std::strcmp(name, "Vector2") == 0) vect2 = parseVec3(value);
+        else if (std::strcmp(name, "Point1") == 0) point1 = parseVec3(value);
+        else if (std::strcmp(name, "Point2") == 0) point2 = parseVec3(value);
+    }
 
-            sceneInfo.cameraInfoVector.push_back(cameraInfo);
-        }
+    material.albedo = color(colors[0], colors[1], colors[2]);
+    material.albedo2 = hasColors2 ? color(colors2[0], colors2[1], colors2[2]) : material.albedo;
+    if (std::strcmp(materialName, "lambertian") == 0) {
+        material.kind = material_kind::lambertian;
+    } else if (std::strcmp(materialName, "metal") == 0) {
+        material.kind = material_kind::metal;
+        material.parameter = colors[3];
+    } else if (std::strcmp(materialName, "dielectric") == 0) {
+        material.kind = material_kind::dielectric;
+        material.parameter = colors[0];
+    } else if (std::strcmp(materialName, "difflight") == 0) {
+        material.kind = material_kind::diffuse_light;
+    } else {
+        std::cerr << "Unknown material \"" << materialName << "\", object skipped" << std::endl;
+        return false;
     }
 
-    return sceneInfo;
+    if (std::strcmp(shape, "sphere") == 0) {
+        primitive.kind = shape_kind::sphere;
+        primitive.p = position;
+        primitive.u = hasPosition2 ? position2 : position;
+        // Sin Position2 la esfera no se mueve
+    } else if (std::strcmp(shape, "quad") == 0) {
+        primitive.kind = shape_kind::quad;
+        primitive.p = origen;
+        primitive.u = vect1;
+        primitive.v = vect2;
+    } else if (std::strcmp(shape, "box") == 0) {
+        primitive.kind = shape_kind::box;
+        primitive.p = point1;
+        primitive.u = point2;
+    } else {
+        std::cerr << "Unknown shape \"" << shape << "\", object skipped" << std::endl;
+        return false;
+    }
+    return true;
 }
 
-std::vector<ObjectInfo> XMLReader::readObjectInfo() {
-    std::vector<ObjectInfo> objectInfoVector;
+bool XMLReader::read(scene_description& scene) {
+    scene = scene_description();
 
     pugi::xml_document doc;
     pugi::xml_parse_result result = doc.load_file(fileName_.c_str());
     if (!result) {
         std::cerr << "Error al cargar el archivo XML. Detalles: " << result.description() << std::endl;
-        return objectInfoVector;
+        return false;
     }
 
     pugi::xml_node sceneNode = doc.child("scene");
-    if (sceneNode) {
-        for (pugi::xml_node objectNode = sceneNode.child("object"); objectNode; objectNode = objectNode.next_sibling("object")) {
-            ObjectInfo objectInfo;
-
-            if (!objectNode.child("Position").empty())
-                objectInfo.position = objectNode.child_value("Position");
-
-            if (!objectNode.child("Position2").empty())
-                objectInfo.position2 = objectNode.child_value("Position2");
-
-            if (!objectNode.child("Shape_type").empty())
-                objectInfo.shapeType = objectNode.child_value("Shape_type");
-
-            if (!objectNode.child("Material").empty())
-                objectInfo.material = objectNode.child_value("Material");
-
-            if (!objectNode.child("Colors").empty())
-                objectInfo.colors = objectNode.child_value("Colors");
-
-            if (!objectNode.child("Colors2").empty())
-                objectInfo.colors2 = objectNode.child_value("Colors2");
-
-            if (!objectNode.child("Ratio").empty()) {
-                try {
-                    objectInfo.ratio = std::stod(objectNode.child_value("Ratio"));
-                } catch (std::invalid_argument&) {
-                    std::cerr << "Invalid argument: Unable to convert Ratio to double" << std::endl;
-                }
-            }
-
-            if (!objectNode.child("Origen").empty())
-                objectInfo.origen = objectNode.child_value("Origen");
-
-            if (!objectNode.child("Vector1").empty())
-                objectInfo.vect_1 = objectNode.child_value("Vector1");
-
-            if (!objectNode.child("Vector2").empty())
-                objectInfo.vect_2 = objectNode.child_value("Vector2");
-
-            if (!objectNode.child("Point1").empty())
-                objectInfo.point_1 = objectNode.child_value("Point1");
-
-            if (!objectNode.child("Point2").empty())
-                objectInfo.point_2 = objectNode.child_value("Point2");
-
-            objectInfoVector.push_back(objectInfo);
+    for (pugi::xml_node node = sceneNode.first_child(); node; node = node.next_sibling()) {
+        if (std::strcmp(node.name(), "camara") == 0) {
+            camera_description camera;
+            if (readCamera(node, camera))
+                scene.cameras.push_back(camera);
+        } else if (std::strcmp(node.name(), "object") == 0) {
+            material_description material;
+            primitive_description primitive;
+            if (!readObject(node, material, primitive))
+                continue;
+            primitive.material = static_cast<uint32_t>(scene.materials.size());
+            scene.materials.push_back(material);
+            scene.primitives.push_back(primitive);
         }
     }
-
-    return objectInfoVector;
-}
\ No newline at end of file
+    return true;
+}
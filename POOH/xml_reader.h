@@ -2,44 +2,27 @@
 #define XML_READER_H
 
 #include <string>
-#include <vector>
-#include "pugixml.hpp"
-
-struct CameraInfo {
-    std::string lookFrom;
-    std::string lookAt;
-    std::string vup;
-    double vfov;
-    std::string backgroundColor;
-};
-
-struct SceneInfo {
-    std::vector<CameraInfo> cameraInfoVector;
-};
-
-struct ObjectInfo {
-    std::string position;
-    std::string position2;
-    std::string shapeType;
-    std::string material;
-    std::string colors;
-    std::string colors2;
-    double ratio;
-    std::string origen;
-    std::string vect_1;
-    std::string vect_2;
-    std::string point_1;
-    std::string point_2;
-};
+#include "RayTracer/scene_description.hpp"
 
+// Reads a scene file:
+//
+//   <scene>
+//     <camara> look_from, look_at, vup, vfov, background_color </camara>
+//     <object> Shape_type, Material, Colors, Colors2, Position, Position2, Ratio,
+//              Origen, Vector1, Vector2, Point1, Point2 </object>
+//     ...
+//   </scene>
+//
+// The document is parsed once and every element is visited once; numbers are converted
+// straight from the parsed text into the typed scene, no intermediate strings.
 class XMLReader {
 public:
     XMLReader(const std::string& fileName);
-    SceneInfo readSceneInfo();
-    std::vector<ObjectInfo> readObjectInfo();
+    bool read(scene_description& scene);
+    // Replaces scene with the contents of the file, returns false if it could not be parsed
 
 private:
     std::string fileName_;
 };
 
-#endif // XML_READER_H
\ No newline at end of file
+#endif // XML_READER_H